@@ -0,0 +1,70 @@
+/**
+ * <baro_manager.h>
+ *
+ * @brief      Barometer sampler thread, keeps the blocking I2C read out of the
+ *             IMU interrupt.
+ *
+ * At BMP_HZ a rate group task in the IMU interrupt wakes the thread, which
+ * then reads the barometer while the interrupt waits for the next DMP sample,
+ * so the read lands in the idle part of the period and doesn't compete with
+ * the MPU for the bus. The thread runs above every thread but the IMU
+ * interrupt so nothing else can stretch a read. If the next DMP interrupt could
+ * still arrive mid-read the read is skipped, and if one arrived during it
+ * anyway the result is discarded, since the DMP interrupt doesn't honour the
+ * I2C bus lock. Both are counted. Each good read is timestamped and published
+ * through a seqlock, and the state estimator picks up the latest one without
+ * blocking.
+ */
+
+#ifndef BARO_MANAGER_H
+#define BARO_MANAGER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * One barometer reading
+ */
+typedef struct baro_sample_t
+{
+    uint64_t timestamp_ns;  ///< when the read finished, ns since boot
+    uint32_t count;         ///< number of good reads so far, changes with each new sample
+    double pressure_pa;     ///< pressure in Pascals
+    double alt_m;           ///< altitude from sea level (m)
+    double temp_c;          ///< temperature of the sensor (C)
+} baro_sample_t;
+
+/**
+ * @brief      Take a first reading, start the sampler thread and register its
+ *             wakeup with the rate group scheduler. rc_bmp_init must be called
+ *             first.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int baro_manager_init(void);
+
+/**
+ * @brief      Copy out the latest sample, never blocks
+ *
+ * @param[out] s     The sample, untouched on failure
+ *
+ * @return     0 on success, -1 if the sampler was publishing a new sample
+ */
+int baro_manager_get_latest(baro_sample_t* s);
+
+/**
+ * @brief      Print the number of skipped reads and the longest read, used on
+ *             exit
+ *
+ * @param      fp    stream to print to
+ */
+void baro_manager_print_report(FILE* fp);
+
+/**
+ * @brief      Stop the sampler thread
+ *
+ * @return     0 on clean exit, -1 on exit time out/force close
+ */
+int baro_manager_cleanup(void);
+
+#endif  // BARO_MANAGER_H
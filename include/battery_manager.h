@@ -0,0 +1,51 @@
+/**
+ * <battery_manager.h>
+ *
+ * @brief      Battery voltage sampler thread, keeps the ADC read and its
+ *             filtering out of the IMU interrupt.
+ *
+ * The barrel jack voltage is read battery_sample_hz times a second, low pass
+ * filtered and checked for sag under load. The result is published through a
+ * seqlock together with the v_nominal/v_batt_lp factor the controllers scale
+ * their gains by, so the IMU interrupt only copies a few numbers.
+ */
+
+#ifndef BATTERY_MANAGER_H
+#define BATTERY_MANAGER_H
+
+/**
+ * Latest battery state
+ */
+typedef struct battery_sample_t
+{
+    double v_raw;  ///< last reading, v_nominal if nothing is on the barrel jack (V)
+    double v_lp;   ///< low pass filtered voltage (V)
+    double comp;   ///< v_nominal / v_lp, multiplies controller gains
+    int sag;       ///< 1 while v_lp is well below the recent resting voltage
+} battery_sample_t;
+
+/**
+ * @brief      Take a first reading and start the sampler thread. rc_adc_init
+ *             must be called first.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int battery_manager_init(void);
+
+/**
+ * @brief      Copy out the latest battery state, never blocks
+ *
+ * @param[out] s     The battery state, untouched on failure
+ *
+ * @return     0 on success, -1 if the sampler was publishing a new one
+ */
+int battery_manager_get_latest(battery_sample_t* s);
+
+/**
+ * @brief      Stop the sampler thread
+ *
+ * @return     0 on clean exit, -1 on exit time out/force close
+ */
+int battery_manager_cleanup(void);
+
+#endif  // BATTERY_MANAGER_H
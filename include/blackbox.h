@@ -0,0 +1,66 @@
+/**
+ * <blackbox.h>
+ *
+ * @brief      In-memory flight recorder which keeps the last few seconds of
+ *             full rate data and only writes it to disk when something goes
+ *             wrong.
+ *
+ * Every field in the log_fields table is captured on every IMU interrupt into
+ * a RAM ring holding blackbox_seconds of data, independent of the log_*
+ * settings and of enable_logging. When an event is triggered a low priority
+ * thread waits a short while so the dump also shows what happened next, then
+ * writes the ring to LOG_DIR as blackbox_<n>_<date>_<time>_<event>.bin in the
+ * normal log format so rc_pilot_log2csv can read it. Dumps are numbered in
+ * order and only the newest blackbox_max_files are kept.
+ */
+
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+/**
+ * Reasons a dump can be triggered, also used in the file name
+ */
+typedef enum blackbox_event_t
+{
+    BLACKBOX_TIPOVER,       ///< feedback_march detected a tipover while armed
+    BLACKBOX_KILL_SWITCH,   ///< kill switch disarmed the vehicle in flight
+    BLACKBOX_OVERRUN,       ///< IMU interrupt took longer than one period
+    BLACKBOX_SENSOR_FAULT,  ///< failed sensor read or lost mocap while armed
+    BLACKBOX_NUM_EVENTS
+} blackbox_event_t;
+
+/**
+ * @brief      Allocate the ring and dump buffer and start the dump thread.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int blackbox_init(void);
+
+/**
+ * @brief      Capture the current state into the ring, overwriting the oldest
+ *             entry. Called from the IMU interrupt after feedback_march.
+ *
+ * @return     0 on success, -1 if the black box isn't running
+ */
+int blackbox_add_new(void);
+
+/**
+ * @brief      Request a dump. Safe to call from the IMU interrupt.
+ *
+ * Triggers that arrive while a dump is pending or within blackbox_seconds of
+ * the last one are ignored since their data is already in that dump.
+ *
+ * @param[in]  event  The reason for the dump
+ *
+ * @return     0 if a dump was scheduled, -1 if ignored or not running
+ */
+int blackbox_trigger(blackbox_event_t event);
+
+/**
+ * @brief      Stop the dump thread, a pending dump is written first.
+ *
+ * @return     0 on clean exit, -1 on exit time out/force close
+ */
+int blackbox_cleanup(void);
+
+#endif  // BLACKBOX_H
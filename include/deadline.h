@@ -0,0 +1,111 @@
+/**
+ * <deadline.h>
+ *
+ * @brief      Deadline monitoring of the IMU interrupt and shedding of
+ *             non-essential work when it keeps overrunning.
+ *
+ * A callback that takes longer than one period of feedback_hz is an overrun.
+ * deadline_check counts it and blames the stage of the timing instrumentation
+ * that took longest in that callback, so a blocking printf, slow sensor read or
+ * log setup on arming shows up against the stage it happened in.
+ *
+ * With enable_degradation set, DEGRADE_OVERRUNS overruns within one window of
+ * DEADLINE_WINDOW_MS sheds the next piece of work in the order of
+ * degrade_level_t, each level keeps the ones before it. Once RECOVER_WINDOWS
+ * windows in a row pass without an overrun one level is restored at a time.
+ * Without it overruns are still counted and attributed.
+ *
+ * Everything here is written only from the IMU interrupt. Other threads read
+ * the deadline state through the snapshot, the per-stage counts are read at
+ * exit and when a log file is closed. The overrun count and degrade level are
+ * logged with every entry so each level change can be found in the log.
+ */
+
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <timing.h>
+
+/**
+ * Work shed while overrunning, in the order it is given up
+ */
+typedef enum degrade_level_t
+{
+    DEGRADE_NONE,          ///< everything runs
+    DEGRADE_LOG_DECIMATE,  ///< only every LOG_DECIMATION'th entry goes to the log file
+    DEGRADE_SKIP_MAG,      ///< magnetometer task skipped, heading holds its last value
+    DEGRADE_PAUSE_PRINTF,  ///< printf manager stops printing
+    DEGRADE_NUM_LEVELS
+} degrade_level_t;
+
+/**
+ * Overrun counters, uint64_t so they can be logged
+ */
+typedef struct deadline_state_t
+{
+    uint64_t overruns;          ///< callbacks that took longer than one period
+    uint64_t level;             ///< current degrade_level_t
+    uint64_t events;            ///< number of level changes either way
+    uint64_t max_level;         ///< highest degrade_level_t reached
+    uint64_t last_total_ns;     ///< length of the most recent overrunning callback
+    timing_stage_t last_stage;  ///< stage that took longest in it
+} deadline_state_t;
+
+extern deadline_state_t deadline;
+
+/**
+ * @brief      Set the budget and window from the settings, call before the IMU
+ *             interrupt starts
+ *
+ * @return     0 on success, -1 on failure
+ */
+int deadline_init(void);
+
+/**
+ * @brief      Check the length of the callback that just finished and step
+ *             the degrade level, called last in __imu_isr
+ *
+ * @param[in]  total_ns  Callback length from timing_isr_end
+ *
+ * @return     1 if this callback overran, 0 otherwise
+ */
+int deadline_check(uint64_t total_ns);
+
+/**
+ * @brief      Whether this callback's entry should go to the log file, every
+ *             one unless the log is being decimated
+ *
+ * @return     1 to log, 0 to skip
+ */
+int deadline_log_due(void);
+
+/**
+ * @brief      Number of overruns where the given stage took longest
+ */
+uint32_t deadline_stage_overruns(timing_stage_t stage);
+
+/**
+ * @brief      Short name of a degrade level for printing
+ */
+const char* deadline_level_name(degrade_level_t level);
+
+/**
+ * @brief      Print a warning for each level change since the last call, from
+ *             the main loop so the IMU interrupt never prints
+ *
+ * @param      fp    stream to print to
+ */
+void deadline_print_events(FILE* fp);
+
+/**
+ * @brief      Print the overrun counts per stage and the degrade levels
+ *             reached, used on exit
+ *
+ * @param      fp    stream to print to
+ */
+void deadline_print_report(FILE* fp);
+
+#endif  // DEADLINE_H
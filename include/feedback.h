@@ -17,6 +17,7 @@
 
 #include <rc_pilot_defs.h>
 #include <stdint.h>  // for uint64_t
+#include <stdio.h>
 
 /**
  * This is the state of the feedback loop. contains most recent values
@@ -25,11 +26,12 @@
  */
 typedef struct feedback_state_t
 {
-    int initialized;        ///< set to 1 after feedback_init(void)
-    arm_state_t arm_state;  ///< actual arm state as reported by feedback controller
-    uint64_t arm_time_ns;   ///< time since boot when controller was armed
-    uint64_t loop_index;    ///< increases every time feedback loop runs
-    uint64_t last_step_ns;  ///< last time controller has finished a step
+    int initialized;           ///< set to 1 after feedback_init(void)
+    arm_state_t arm_state;     ///< actual arm state as reported by feedback controller
+    uint64_t arm_time_ns;      ///< time since boot when controller was armed
+    uint64_t loop_index;       ///< increases every time feedback loop runs
+    uint64_t last_step_ns;     ///< last time controller has finished a step
+    uint64_t arm_duration_ns;  ///< time spent in the last call to feedback_arm
 
     double u[6];  ///< siso controller outputs
     double m[8];  ///< signals sent to motors after mapping
@@ -78,6 +80,14 @@ int feedback_disarm(void);
  */
 int feedback_arm(void);
 
+/**
+ * @brief      Print tipovers and rejected arm requests since the last call.
+ *             The IMU interrupt only counts them, the main loop prints.
+ *
+ * @param      fp    stream to print to
+ */
+void feedback_print_events(FILE* fp);
+
 /**
  * @brief      Cleanup the feedback controller, freeing memory
  *
@@ -34,7 +34,7 @@ typedef enum dsm_kill_mode_t
 /**
  * Represents current command by the user. This is populated by the
  * input_manager thread which decides to read from mavlink or DSM depending on
- * what it is receiving.
+ * what it is receiving, other threads get a copy from input_manager_get_latest.
  */
 typedef struct user_input_t
 {
@@ -50,8 +50,6 @@ typedef struct user_input_t
     double pitch_stick;  ///< positive forward
 } user_input_t;
 
-extern user_input_t user_input;
-
 /**
  * @brief      Starts an input manager thread.
  *
@@ -62,6 +60,16 @@ extern user_input_t user_input;
  */
 int input_manager_init(void);
 
+/**
+ * @brief      Copy out the latest user input, never blocks. The DSM callbacks
+ *             publish it once per packet.
+ *
+ * @param[out] u     The user input, untouched on failure
+ *
+ * @return     0 on success, -1 if the DSM callback was publishing a new one
+ */
+int input_manager_get_latest(user_input_t* u);
+
 /**
  * @brief      Waits for the input manager thread to exit
  *
@@ -0,0 +1,71 @@
+/**
+ * <log_fields.h>
+ *
+ * @brief      The table of values that can be logged and the machinery to
+ *             capture a chosen set of them.
+ *
+ * Both the log manager and the black box recorder pick groups of fields from
+ * the same table. log_fields_init() compiles the chosen groups into file
+ * header descriptors and a flat copy plan, after which capturing an entry is
+ * one 8-byte copy per enabled field.
+ */
+
+#ifndef LOG_FIELDS_H
+#define LOG_FIELDS_H
+
+#include <stdint.h>
+
+#include <log_format.h>
+
+/**
+ * Column layout and copy plan for one kind of log file
+ */
+typedef struct log_fields_t
+{
+    log_field_desc_t desc[LOG_MAX_FIELDS];  ///< descriptors for the file header
+    const void* src[LOG_MAX_FIELDS];        ///< where each value is copied from
+    int num;                                ///< number of enabled fields
+    uint32_t groups;                        ///< bitmask of (1 << log_group_t)
+    int record_len;                         ///< bytes per uncompressed entry record
+} log_fields_t;
+
+/**
+ * @brief      Bitmask of groups enabled by the log_* flags in the settings
+ *             file. The index group is always included.
+ */
+uint32_t log_fields_groups_from_settings(void);
+
+/**
+ * @brief      Pick the fields in the given groups out of the table and build
+ *             the column layout and copy plan. Motor signals are limited to
+ *             settings.num_rotors.
+ *
+ * @param      f       layout to fill in
+ * @param[in]  groups  bitmask of (1 << log_group_t)
+ *
+ * @return     number of fields enabled
+ */
+int log_fields_init(log_fields_t* f, uint32_t groups);
+
+/**
+ * @brief      Copy the current value of every enabled field to dst in file
+ *             order. Safe to call from the IMU interrupt.
+ *
+ * @param      f     initialized layout
+ * @param      dst   room for f->num values
+ */
+void log_fields_capture(const log_fields_t* f, uint64_t* dst);
+
+/**
+ * @brief      Size of the file header and field descriptors
+ */
+int log_fields_header_len(const log_fields_t* f);
+
+/**
+ * @brief      Write the file header and field descriptors to dst
+ *
+ * @return     number of bytes written, same as log_fields_header_len()
+ */
+int log_fields_write_header(const log_fields_t* f, char* dst);
+
+#endif  // LOG_FIELDS_H
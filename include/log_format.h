@@ -0,0 +1,218 @@
+/**
+ * <log_format.h>
+ *
+ * @brief      On-disk layout of the binary flight logs written by log_manager
+ *             and read back by the rc_pilot_log2csv tool.
+ *
+ * A log file starts with a log_file_header_t immediately followed by one
+ * log_field_desc_t for every column that was enabled in the settings file.
+ * After that comes a stream of records, each starting with a one byte record
+ * type. Entry records are fixed size and contain the fields in the order given
+ * by the field descriptors. A zero byte where a record type is expected marks
+ * the end of the data in a file that was preallocated and never closed.
+ *
+ * When any field has a nonzero resolution the file is compressed and holds
+ * keyframe and delta records instead of entry records. Both start with the
+ * type byte and a uint16_t payload length so a reader can skip over them. The
+ * payload holds one value per field in descriptor order:
+ *  - LOG_TYPE_U64 fields are a varint, the raw value in a keyframe and the
+ *    zigzag encoded difference from the previous record in a delta.
+ *  - LOG_TYPE_F64 fields with a resolution are quantized to
+ *    log_quantize(value, resolution) and written like U64 fields.
+ *  - LOG_TYPE_F64 fields with zero resolution are 8 raw bytes in both.
+ * A keyframe is written at the start of every file and then every
+ * log_keyframe_interval entries so decoding can start from any keyframe.
+ *
+ * A cleanly closed file ends with a timing record describing how long each
+ * stage of the IMU interrupt has taken since rc_pilot started and how many
+ * overruns it was blamed for, followed by the trailer.
+ *
+ * Everything is written in the native byte order of the BeagleBone which is
+ * little endian, same as any PC the logs are likely to be converted on.
+ *
+ * This header must not depend on anything from librobotcontrol so the log
+ * converter can be built on a host computer.
+ */
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <math.h>
+#include <stdint.h>
+
+#define LOG_FILE_MAGIC "RCPL"   ///< first 4 bytes of every log file
+#define LOG_FORMAT_VERSION 7    ///< bump whenever the layout below changes
+#define LOG_FILE_EXT ".bin"     ///< extension of binary log files in LOG_DIR
+#define LOG_FIELD_NAME_LEN 20   ///< including null terminator
+#define LOG_FIELD_UNIT_LEN 8    ///< including null terminator
+#define LOG_TIMING_NAME_LEN 12  ///< including null terminator
+#define LOG_MAX_FIELDS 64       ///< upper limit on columns in one file
+#define LOG_VARINT_MAX_LEN 10   ///< bytes needed for the largest 64-bit varint
+#define LOG_QUANT_LIMIT 4.0e18  ///< quantized values are clamped to +- this
+#define LOG_QUANT_NAN INT64_MIN ///< quantized value reserved for NaN
+
+/**
+ * Groups of fields that can be enabled and disabled together in the settings
+ * file. The file header stores which groups were enabled as a bitmask of
+ * (1 << log_group_t).
+ */
+typedef enum log_group_t
+{
+    LOG_GROUP_INDEX,  ///< loop index, timing and overruns, always logged
+    LOG_GROUP_SENSORS,
+    LOG_GROUP_STATE,
+    LOG_GROUP_SETPOINT,
+    LOG_GROUP_CONTROL_U,
+    LOG_GROUP_MOTOR_SIGNALS,
+    LOG_NUM_GROUPS
+} log_group_t;
+
+/**
+ * Data type of a single field within an entry record
+ */
+typedef enum log_type_t
+{
+    LOG_TYPE_U64 = 1,  ///< uint64_t, printed as an integer
+    LOG_TYPE_F64 = 2   ///< double, printed with 4 decimal places
+} log_type_t;
+
+/**
+ * The one byte tag at the start of every record following the header
+ */
+typedef enum log_record_t
+{
+    LOG_RECORD_NONE = 0x00,    ///< unwritten preallocated space
+    LOG_RECORD_ENTRY = 0xE1,     ///< one value per field descriptor, uncompressed
+    LOG_RECORD_KEYFRAME = 0x4B,  ///< compressed entry holding absolute values
+    LOG_RECORD_DELTA = 0xDE,     ///< compressed entry relative to the previous one
+    LOG_RECORD_TIMING = 0x71,    ///< uint16_t length then log_timing_stat_t per stage
+    LOG_RECORD_TRAILER = 0x7A    ///< log_trailer_t, last record of a cleanly closed file
+} log_record_t;
+
+/**
+ * Fixed part of the file header
+ */
+typedef struct __attribute__((packed)) log_file_header_t
+{
+    char magic[4];        ///< LOG_FILE_MAGIC, not null terminated
+    uint16_t version;     ///< LOG_FORMAT_VERSION of the writer
+    uint16_t num_fields;  ///< number of log_field_desc_t after this header
+    uint32_t groups;      ///< bitmask of (1 << log_group_t) enabled in this file
+    uint16_t num_rotors;  ///< number of motors on the vehicle that wrote the log
+    uint16_t record_len;  ///< bytes per entry record including the type byte
+} log_file_header_t;
+
+/**
+ * Describes one column of the log, these follow the file header in the same
+ * order the values appear in each entry record.
+ */
+typedef struct __attribute__((packed)) log_field_desc_t
+{
+    char name[LOG_FIELD_NAME_LEN];  ///< column name, null terminated
+    uint8_t type;                   ///< log_type_t
+    uint8_t group;                  ///< log_group_t the field belongs to
+    uint16_t reserved;              ///< zero
+    char unit[LOG_FIELD_UNIT_LEN];  ///< SI unit of the value, null terminated
+    double resolution;              ///< quantization step, 0 for uncompressed
+} log_field_desc_t;
+
+/**
+ * Execution time statistics for one stage of the IMU interrupt
+ */
+typedef struct __attribute__((packed)) log_timing_stat_t
+{
+    char name[LOG_TIMING_NAME_LEN];  ///< stage name, null terminated
+    uint32_t count;                  ///< number of samples
+    uint32_t min_ns;
+    uint32_t p50_ns;
+    uint32_t p99_ns;
+    uint32_t p999_ns;
+    uint32_t max_ns;
+    uint32_t overruns;  ///< overrunning callbacks where this stage took longest
+} log_timing_stat_t;
+
+/**
+ * Summary written when a log file is closed. A file without a trailer was not
+ * closed cleanly.
+ */
+typedef struct __attribute__((packed)) log_trailer_t
+{
+    uint64_t num_entries;      ///< entries written to this file
+    uint64_t num_dropped;      ///< entries lost because the ring buffer was full
+    uint32_t high_water;       ///< most entries ever waiting in the ring buffer
+    uint32_t buffer_len;       ///< depth of the ring buffer
+    uint64_t arm_duration_ns;  ///< time feedback_arm took to start this file
+} log_trailer_t;
+
+/**
+ * @brief      Append v to dst as an LEB128 varint, 7 bits per byte with the
+ *             high bit set on all but the last byte.
+ *
+ * @return     number of bytes written, at most LOG_VARINT_MAX_LEN
+ */
+static inline int log_put_varint(uint8_t* dst, uint64_t v)
+{
+    int n = 0;
+    while (v >= 0x80)
+    {
+        dst[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    dst[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * @brief      Read a varint written by log_put_varint
+ *
+ * @return     number of bytes consumed, -1 if it runs past end
+ */
+static inline int log_get_varint(const uint8_t* src, const uint8_t* end, uint64_t* v)
+{
+    int n = 0;
+    int shift = 0;
+
+    *v = 0;
+    while (src + n < end && shift < 64)
+    {
+        *v |= (uint64_t)(src[n] & 0x7F) << shift;
+        if ((src[n++] & 0x80) == 0) return n;
+        shift += 7;
+    }
+    return -1;
+}
+
+/**
+ * @brief      Map signed differences to unsigned so small magnitudes of either
+ *             sign make short varints.
+ */
+static inline uint64_t log_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t log_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/**
+ * @brief      Round x to a whole number of resolution steps. Out of range
+ *             values are clamped and NaN maps to LOG_QUANT_NAN.
+ */
+static inline int64_t log_quantize(double x, double resolution)
+{
+    double q = x / resolution;
+    if (isnan(q)) return LOG_QUANT_NAN;
+    if (q > LOG_QUANT_LIMIT) return (int64_t)LOG_QUANT_LIMIT;
+    if (q < -LOG_QUANT_LIMIT) return -(int64_t)LOG_QUANT_LIMIT;
+    return llround(q);
+}
+
+static inline double log_dequantize(int64_t q, double resolution)
+{
+    if (q == LOG_QUANT_NAN) return NAN;
+    return q * resolution;
+}
+
+#endif  // LOG_FORMAT_H
@@ -10,94 +10,43 @@
 #define LOG_MANAGER_H
 
 /**
- * Struct containing all possible values that could be writen to the log. For
- * each log entry you wish to create, fill in an instance of this and pass to
- * add_log_entry(void). You do not need to populate all parts of the struct.
- * Currently feedback.c populates all values and log_manager.c only writes the
- * values enabled in the settings file.
+ * @brief      creates a new binary log file and starts the background thread.
+ *
+ * Entries go to this first file until log_manager_new_segment() is called.
+ * The background thread always keeps the next file in the series open with
+ * its header written so starting a new segment doesn't touch the disk.
+ *
+ * Files are numbered from a counter kept in LOG_DIR so startup time doesn't
+ * grow with the number of logs on the card. When log_max_files or log_max_mb
+ * is exceeded the background thread deletes the oldest logs.
+ *
+ * The file layout is described in log_format.h, use rc_pilot_log2csv to
+ * convert it to csv.
+ *
+ * @return     0 on success, -1 on failure
  */
-typedef struct log_entry_t
-{
-    /** @name index, always printed */
-    ///@{
-    uint64_t loop_index;  // timing
-    uint64_t last_step_ns;
-    ///@}
-
-    /** @name sensors */
-    ///@{
-    double v_batt;
-    double alt_bmp_raw;
-    double gyro_roll;
-    double gyro_pitch;
-    double gyro_yaw;
-    double accel_X;
-    double accel_Y;
-    double accel_Z;
-    ///@}
-
-    /** @name state estimate */
-    ///@{
-    double roll;
-    double pitch;
-    double yaw;
-    double X;
-    double Y;
-    double Z;
-    double Xdot;
-    double Ydot;
-    double Zdot;
-    ///@}
-
-    /** @name setpoint */
-    ///@{
-    double sp_roll;
-    double sp_pitch;
-    double sp_yaw;
-    double sp_X;
-    double sp_Y;
-    double sp_Z;
-    double sp_Xdot;
-    double sp_Ydot;
-    double sp_Zdot;
-    ///@}
-
-    /** @name orthogonal control outputs */
-    ///@{
-    double u_roll;
-    double u_pitch;
-    double u_yaw;
-    double u_X;
-    double u_Y;
-    double u_Z;
-    ///@}
-
-    /** @name motor signals */
-    ///@{
-    double mot_1;
-    double mot_2;
-    double mot_3;
-    double mot_4;
-    double mot_5;
-    double mot_6;
-    double mot_7;
-    double mot_8;
-    ///@}
-
-} log_entry_t;
+int log_manager_init(void);
 
 /**
- * @brief      creates a new csv log file and starts the background thread.
+ * @brief      Start a new log file with the next entry.
  *
- * @return     0 on success, -1 on failure
+ * Called by feedback_arm from the IMU interrupt so this only sets a flag. The
+ * next entry added is tagged and the writer thread switches over to the file
+ * it already has open when it reaches that entry.
+ *
+ * @return     0 on success, -1 if the log manager isn't running
  */
-int log_manager_init(void);
+int log_manager_new_segment(void);
 
 /**
  * @brief      quickly add new data to local buffer
  *
  * This is called after feedback_march after signals have been sent to
- * the motors.
+ * the motors. The fields enabled in the settings file are copied from the
+ * global state, feedback, and setpoint structs as listed in the log_sources
+ * table in log_fields.c. The entry goes into a lock-free ring buffer shared
+ * with the writer thread, if the ring is full the entry is dropped and counted
+ * in the log trailer.
  *
  * @return     0 on success, -1 on failure
  */
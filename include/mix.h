@@ -43,6 +43,10 @@ typedef enum rotor_layout_t
  *             mixing_matrix.c below to interface with it. Used in
  *             mixing_matrix.c
  *
+ *             This also selects the mix_all_controls and mix_allocate kernels
+ *             compiled for the layout, with the rotor count and matrix entries
+ *             built in.
+ *
  * @param[in]  layout  The layout enum
  *
  * @return     0 on success, -1 on failure
@@ -106,4 +110,57 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max);
  */
 int mix_add_input(double u, int ch, double* mot);
 
+/**
+ * @brief      Source of a channel input for mix_allocate, for controllers that
+ *             need to know the usable range before they run.
+ *
+ * @param[in]  ch    channel
+ * @param[in]  min   The minimum possible input without saturation
+ * @param[in]  max   The maximum possible input without saturation
+ *
+ * @return     the input to apply on channel ch, expected within [min,max]
+ */
+typedef double (*mix_input_t)(int ch, double min, double max);
+
+/**
+ * @brief      Mixes all control inputs in one call, giving priority to the
+ *             channels that keep the vehicle in the air.
+ *
+ *             Channels are added in the order Z, roll, pitch, yaw, then X and Y
+ *             for 6dof layouts. Before each channel after Z the range it can
+ *             use without saturating a motor is found from what has been
+ *             mixed so far and limited to +-u_max[ch], and u[ch] is clipped to
+ *             it. If input[ch] is given it is called with that range instead
+ *             and its return value used. The result is identical to calling
+ *             mix_check_saturation and mix_add_input for each channel in turn
+ *             but motors stay local and the matrix is only checked once.
+ *
+ * @param      u      6 control inputs, overwritten with the inputs applied.
+ *                    Channels the layout can't produce are set to 0.
+ * @param[in]  u_max  Magnitude limit for each channel, not used for Z
+ * @param[in]  input  Optional input sources per channel, may be NULL. Not
+ *                    used for Z.
+ * @param[out] mot    motor outputs, between 0 and 1
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_allocate(double u[6], const double u_max[6], const mix_input_t input[6], double* mot);
+
+/**
+ * @brief      Single precision version of mix_allocate for the MIX_F32 build.
+ *
+ *             Same priority scheme as mix_allocate but every rotor is handled
+ *             in float lanes, with NEON when built for it (make MIX_F32=1 on
+ *             the BeagleBone) and plain C otherwise. Results agree with
+ *             mix_allocate to float precision, not bit for bit.
+ *
+ * @param      u      6 control inputs, overwritten with the inputs applied
+ * @param[in]  u_max  Magnitude limit for each channel, not used for Z
+ * @param[in]  input  Optional input sources per channel, may be NULL
+ * @param[out] mot    motor outputs, between 0 and 1
+ *
+ * @return     0 on success, -1 on failure
+ */
+int mix_allocate_f32(double u[6], const double u_max[6], const mix_input_t input[6], float* mot);
+
 #endif  // MIXING_MATRIX_H
\ No newline at end of file
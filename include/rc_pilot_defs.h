@@ -17,12 +17,12 @@ typedef enum arm_state_t
     ARMED
 } arm_state_t;
 
-// Speed of feedback loop
-#define FEEDBACK_HZ 200
-#define DT 0.005
+// Speed of feedback loop is settings.feedback_hz, which must divide
+// MAX_FEEDBACK_HZ since the DMP can only sample at divisors of 200Hz
+#define MAX_FEEDBACK_HZ 200
 
 // IMU Parameters
-#define IMU_PRIORITY 51
+#define IMU_PRIORITY 90  // above every thread in thread_defs.h
 #define I2C_BUS 2
 #define GPIO_INT_PIN_CHIP 3
 #define GPIO_INT_PIN_PIN 21
@@ -52,7 +52,8 @@ typedef enum arm_state_t
 #define THROTTLE_DEADZONE 0.02
 #define SOFT_START_SECONDS 1.0  // controller soft start seconds
 #define ALT_CUTOFF_FREQ 2.0
-#define BMP_RATE_DIV 10  // optionally sample bmp less frequently than mpu
+#define XY_VEL_CUTOFF_FREQ 5.0  // rad/s, lowpass on mocap velocity for the horizontal cascade
+#define BMP_HZ 20  // sample bmp less frequently than mpu
 
 // controller absolute limits
 #define MAX_ROLL_COMPONENT 0.4
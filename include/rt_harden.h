@@ -0,0 +1,76 @@
+/**
+ * <rt_harden.h>
+ *
+ * @brief      Keep page faults and heap allocation out of the real time
+ *             threads.
+ *
+ * With enable_rt_hardening set, rt_harden_init makes everything mapped at
+ * startup resident and locks it, the code and data of rc_pilot and its
+ * libraries included, so even rarely run paths of the IMU interrupt can't take
+ * a major fault. Pages of later mappings are locked as they are first touched
+ * (MCL_ONFAULT) so large file mappings aren't read in whole. It stops malloc
+ * from giving memory back to the kernel or serving allocations with mmap,
+ * faults in the heap the small allocations during init come from, and shrinks
+ * the default thread stack to THREAD_STACK_SIZE. Since a page of a later
+ * mapping is only locked once touched, every SCHED_FIFO thread calls
+ * rt_prefault_stack when it starts and large buffers the IMU interrupt writes
+ * are touched with rt_prefault when allocated.
+ *
+ * In a debug build (make debug) malloc, calloc, realloc and free are wrapped
+ * and rt_isr_begin/rt_isr_end count heap calls and page faults made by the
+ * IMU interrupt between them. The first offending callback is reported on
+ * stderr and the totals by rt_print_report on exit. In normal builds these do
+ * nothing.
+ */
+
+#ifndef RT_HARDEN_H
+#define RT_HARDEN_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief      Lock memory and tune malloc for real time use. Call once from
+ *             main before any thread is started or buffer allocated.
+ *
+ * @return     0 on success, -1 on failure
+ */
+int rt_harden_init(void);
+
+/**
+ * @brief      Touch THREAD_STACK_PREFAULT bytes of the calling thread's stack
+ *             so it is mapped before it's needed, call first thing in a real
+ *             time thread
+ */
+void rt_prefault_stack(void);
+
+/**
+ * @brief      Touch every page of a buffer so it is mapped and locked before
+ *             the IMU interrupt writes to it, keeps its contents
+ *
+ * @param      buf   start of the buffer
+ * @param[in]  len   length in bytes
+ */
+void rt_prefault(void* buf, size_t len);
+
+/**
+ * @brief      Start watching for heap calls and page faults, first thing in
+ *             __imu_isr. Does nothing outside debug builds.
+ */
+void rt_isr_begin(void);
+
+/**
+ * @brief      Stop watching and record what happened since rt_isr_begin, last
+ *             thing in __imu_isr. Does nothing outside debug builds.
+ */
+void rt_isr_end(void);
+
+/**
+ * @brief      Print the heap call and page fault counts of the IMU interrupt,
+ *             used on exit. Prints nothing outside debug builds.
+ *
+ * @param      fp    stream to print to
+ */
+void rt_print_report(FILE* fp);
+
+#endif  // RT_HARDEN_H
@@ -0,0 +1,63 @@
+/**
+ * <scheduler.h>
+ *
+ * @brief      Rate groups for low rate work inside the IMU interrupt.
+ *
+ * Tasks are registered at a rate up to settings.feedback_hz and run from
+ * sched_tick, which __imu_isr calls once per DMP sample after feedback_march.
+ * The rate is rounded to the nearest feedback_hz/div for a whole divisor div
+ * of feedback_hz, and the task runs on the ticks where tick % div equals its
+ * phase. Tasks registered with SCHED_AUTO_PHASE get the phase whose busiest
+ * tick has the fewest tasks already, so for example a 20Hz and a 10Hz task
+ * don't land on the same tick.
+ *
+ * Execution time is kept per task, per rate group, and per tick of the
+ * repeating pattern of due tasks so the worst case tick can be found and
+ * balanced. Statistics are only written from the IMU interrupt and read at
+ * exit.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdio.h>
+
+#define SCHED_MAX_TASKS 16
+#define SCHED_AUTO_PHASE -1  ///< let sched_add pick the least loaded phase
+
+/**
+ * Task function, return -1 on failure. Failures are counted and reported by
+ * sched_tick but don't stop the task from running next time.
+ */
+typedef int (*sched_func_t)(void);
+
+/**
+ * @brief      Register a task. Must be done after the settings are loaded and
+ *             before the IMU interrupt starts.
+ *
+ * @param[in]  name   Short name for the report
+ * @param[in]  func   The task
+ * @param[in]  hz     Rate, rounded to one that divides settings.feedback_hz
+ * @param[in]  phase  Tick within the period to run on, 0 to div-1, or
+ *                    SCHED_AUTO_PHASE
+ *
+ * @return     0 on success, -1 on failure
+ */
+int sched_add(const char* name, sched_func_t func, int hz, int phase);
+
+/**
+ * @brief      Run every task due on this tick, called once per IMU interrupt
+ *
+ * @return     0 on success, -1 if any task failed
+ */
+int sched_tick(void);
+
+/**
+ * @brief      Print a table of tasks, rate groups and the worst tick, used on
+ *             exit
+ *
+ * @param      fp    stream to print to
+ */
+void sched_print_report(FILE* fp);
+
+#endif  // SCHEDULER_H
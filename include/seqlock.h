@@ -0,0 +1,111 @@
+/**
+ * <seqlock.h>
+ *
+ * @brief      Sequence lock for publishing a small struct from one writer
+ *             thread to readers that must never block.
+ *
+ * The writer makes the sequence odd, copies the data in and makes it even
+ * again. A reader notes the sequence, copies the data out and checks the
+ * sequence didn't change and wasn't odd, otherwise the copy may be torn and is
+ * thrown away. Readers never wait for the writer so they can run in the IMU
+ * interrupt, but on a single core a reader that preempted the writer mid-write
+ * will keep failing until the writer runs again, so readers must limit their
+ * retries and fall back to the previous value.
+ *
+ * Only one writer is allowed per lock, several writer threads must serialize
+ * among themselves. seqlock_write and seqlock_read wrap the whole sequence for
+ * publishing a struct by copy.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct seqlock_t
+{
+    atomic_uint seq;
+} seqlock_t;
+
+#define SEQLOCK_INITIALIZER \
+    {                       \
+        0                   \
+    }
+
+static inline void seqlock_write_begin(seqlock_t* s)
+{
+    unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    // data writes can't move above the odd sequence
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void seqlock_write_end(seqlock_t* s)
+{
+    unsigned int seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * @brief      Start a read
+ *
+ * @return     sequence to pass to seqlock_read_retry
+ */
+static inline unsigned int seqlock_read_begin(seqlock_t* s)
+{
+    return atomic_load_explicit(&s->seq, memory_order_acquire);
+}
+
+/**
+ * @brief      Check a read
+ *
+ * @return     0 if the data copied since seqlock_read_begin is consistent, 1 if
+ *             it must be thrown away
+ */
+static inline int seqlock_read_retry(seqlock_t* s, unsigned int start)
+{
+    // data reads can't move below the second look at the sequence
+    atomic_thread_fence(memory_order_acquire);
+    return (start & 1) || atomic_load_explicit(&s->seq, memory_order_relaxed) != start;
+}
+
+/**
+ * @brief      Publish n bytes from src into the shared copy dst
+ */
+static inline void seqlock_write(seqlock_t* s, void* dst, const void* src, size_t n)
+{
+    seqlock_write_begin(s);
+    memcpy(dst, src, n);
+    seqlock_write_end(s);
+}
+
+/**
+ * @brief      Copy n bytes out of the shared copy src, trying up to tries times
+ *             to get one that isn't torn
+ *
+ * @param      s      The lock
+ * @param[out] dst    The copy, may be torn on failure so use a scratch copy
+ *                    when the last good value has to be kept
+ * @param[in]  src    The shared copy
+ * @param[in]  n      Size of the copy
+ * @param[in]  tries  Attempts before giving up
+ *
+ * @return     0 on success, -1 if every attempt was torn
+ */
+static inline int seqlock_read(seqlock_t* s, void* dst, const void* src, size_t n, int tries)
+{
+    int i;
+    unsigned int seq;
+
+    for (i = 0; i < tries; i++)
+    {
+        seq = seqlock_read_begin(s);
+        memcpy(dst, src, n);
+        if (!seqlock_read_retry(s, seq)) return 0;
+    }
+    return -1;
+}
+
+#endif  // SEQLOCK_H
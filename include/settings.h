@@ -31,13 +31,29 @@ typedef struct settings_t
     int warnings_en;
     ///@}
 
+    /** @name control loop rate */
+    ///@{
+    int feedback_hz;  ///< DMP sample rate and control loop rate, divides MAX_FEEDBACK_HZ
+    double dt;        ///< 1/feedback_hz, everything discretized uses this
+    ///@}
+
+    /** @name real time */
+    ///@{
+    int enable_rt_hardening;  ///< lock memory and prefault real time thread stacks
+    int enable_degradation;   ///< shed non-essential work while the IMU interrupt overruns
+    ///@}
+
     /** @name physical parameters */
     ///@{
     int num_rotors;
     rotor_layout_t layout;
     int dof;
     thrust_map_t thrust_map;
+    double thrust_map_custom[THRUST_MAP_MAX_POINTS][2];  // {signal, thrust} rows for CUSTOM_MAP
+    int thrust_map_custom_points;
+    int thrust_map_lut_len;
     double v_nominal;
+    int battery_sample_hz;
     int enable_magnetometer;  // we suggest leaving as 0 (mag OFF)
     ///@}
 
@@ -76,6 +92,7 @@ typedef struct settings_t
     int printf_u;
     int printf_motors;
     int printf_mode;
+    int printf_timing;
     ///@}
 
     /** @name log settings */
@@ -86,6 +103,23 @@ typedef struct settings_t
     int log_setpoint;
     int log_control_u;
     int log_motor_signals;
+    int log_buffer_len;             ///< entries the log ring buffer can hold
+    int log_segment_seconds;        ///< log file space preallocated at a time
+    int log_keyframe_interval;      ///< entries between keyframes in compressed logs
+    int log_max_files;              ///< oldest logs are deleted past this, 0 for no limit
+    int log_max_mb;                 ///< same for total size of the logs in MB
+    double log_resolution_sensors;  ///< quantization step, 0.0 to not compress
+    double log_resolution_state;
+    double log_resolution_setpoint;
+    double log_resolution_control_u;
+    double log_resolution_motor_signals;
+    ///@}
+
+    /** @name black box recorder */
+    ///@{
+    int enable_blackbox;     ///< keep recent data in RAM and dump it on faults
+    int blackbox_seconds;    ///< seconds of data kept in RAM
+    int blackbox_max_files;  ///< oldest dumps are deleted past this, 0 for no limit
     ///@}
 
     /** @name mavlink stuff */
@@ -100,6 +134,7 @@ typedef struct settings_t
     rc_filter_t pitch_controller;
     rc_filter_t yaw_controller;
     rc_filter_t altitude_controller;
+    int horiz_ctrl_divisor;  ///< horizontal cascade runs at feedback_hz/horiz_ctrl_divisor
     rc_filter_t horiz_vel_ctrl_4dof;
     rc_filter_t horiz_vel_ctrl_6dof;
     rc_filter_t horiz_pos_ctrl_4dof;
@@ -0,0 +1,54 @@
+/**
+ * <snapshot.h>
+ *
+ * @brief      Consistent copies of the flight state for threads other than the
+ *             IMU interrupt.
+ *
+ * state_estimate, setpoint, fstate and deadline are written field by field
+ * during __imu_isr, so another thread reading them directly can see half of one
+ * tick and half of the next. Once a tick is done, snapshot_publish copies all
+ * of them into one seqlock protected snapshot which readers copy out without
+ * ever blocking the IMU interrupt. The printf, log and input manager threads read
+ * the flight state only through here, user_input has its own snapshot in
+ * input_manager.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <deadline.h>
+#include <feedback.h>
+#include <setpoint_manager.h>
+#include <state_estimator.h>
+
+/**
+ * Flight state at the end of one IMU interrupt
+ */
+typedef struct snapshot_t
+{
+    uint64_t tick;  ///< number of snapshots published before this one
+    state_estimate_t state;
+    setpoint_t setpoint;
+    feedback_state_t fstate;
+    deadline_state_t deadline;  ///< as of the end of the previous callback
+} snapshot_t;
+
+/**
+ * @brief      Publish the current flight state, called once at the end of
+ *             __imu_isr. Nothing else may call it.
+ */
+void snapshot_publish(void);
+
+/**
+ * @brief      Copy out the latest snapshot, never blocks
+ *
+ * @param[out] s     The snapshot, untouched on failure
+ *
+ * @return     0 on success, -1 if none has been published yet or the IMU
+ *             interrupt kept publishing over the copy
+ */
+int snapshot_get(snapshot_t* s);
+
+#endif  // SNAPSHOT_H
@@ -14,6 +14,7 @@
 #include <rc/mpu.h>
 #include <rc_pilot_defs.h>
 #include <stdint.h>  // for uint64_t
+#include <stdio.h>
 
 /**
  * This is the output from the state estimator. It contains raw sensor values
@@ -34,8 +35,9 @@ typedef struct state_estimate_t
 
     /** @name IMU (accel gyro)
      * Normalized Quaternion is straight from the DMP but converted to NED
-     * coordinates. Tait-Bryan angles roll pitch and yaw angles are then
-     * converted from the quaternion.
+     * coordinates, feedback uses it directly. Tait-Bryan angles roll pitch and
+     * yaw angles are converted from it at 50Hz by a rate group task since only
+     * the log, printf, arming checks and the landed yaw setpoint need them.
      * the roll_pitch_yaw values in the taid bryan angles tb_imu are bounded
      * by +-pi since they come straight from the quaternion. the state estimator
      * keeps track of these rotations and generates continuous_yaw which is
@@ -57,10 +59,9 @@ typedef struct state_estimate_t
     ///@{
     double mag[3];           ///< magnetometer XYZ NED coordinates ()
     double mag_heading_raw;  ///< raw compass heading
-    double mag_heading;      ///< compass heading filtered with IMU
+    double mag_heading;      ///< compass heading filtered with IMU, yaw of quat_mag
     double mag_heading_continuous;
     double quat_mag[4];  ///< quaterion filtered
-    double tb_mag[3];    ///< roll pitch yaw with magetometer heading fixed (rad)
     ///@}
 
     /** @name selected values for feedback
@@ -68,6 +69,7 @@ typedef struct state_estimate_t
      * this is done so we can easily chose which source to get feedback from (mag or no mag)
      */
     ///@{
+    double quat[4];  ///< attitude quaternion, used by feedback instead of the angles
     double roll;
     double pitch;
     double yaw;
@@ -126,9 +128,11 @@ typedef struct state_estimate_t
 
     /** @name Other */
     ///@{
-    double v_batt_raw;  ///< main battery pack voltage (v)
-    double v_batt_lp;   ///< main battery pack voltage with low pass filter (v)
-    double bmp_temp;    ///< temperature of barometer
+    double v_batt_raw;   ///< main battery pack voltage (v)
+    double v_batt_lp;    ///< main battery pack voltage with low pass filter (v)
+    double v_batt_comp;  ///< v_nominal / v_batt_lp, controller gains are scaled by this
+    int batt_sag;        ///< 1 while the battery is sagging under load
+    double bmp_temp;     ///< temperature of barometer
                         ///@}
 
 } state_estimate_t;
@@ -139,7 +143,8 @@ extern rc_mpu_data_t mpu_data;
 /**
  * @brief      Initial setup of the state estimator
  *
- * barometer must be initialized first
+ * baro_manager and battery_manager must be initialized first. Registers the
+ * magnetometer and mocap timeout jobs with the rate group scheduler.
  *
  * @return     0 on success, -1 on failure
  */
@@ -155,13 +160,12 @@ int state_estimator_init(void);
 int state_estimator_march(void);
 
 /**
- * @brief      jobs the state estimator must do after feedback_controller
+ * @brief      Print sensor warnings raised since the last call. The IMU
+ *             interrupt only counts them, the main loop prints.
  *
- * Called immediately after feedback_march in the ISR. Currently this reads
- *
- * @return     0 on success, -1 on failure
+ * @param      fp    stream to print to
  */
-int state_estimator_jobs_after_feedback(void);
+void state_estimator_print_events(FILE* fp);
 
 /**
  * @brief      Cleanup the state estimator, freeing memory
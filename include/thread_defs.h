@@ -4,15 +4,25 @@
 #define THREAD_DEFS_H
 
 // thread speeds, prioritites, and close timeouts
+#define THREAD_STACK_SIZE (512 * 1024)     // default for new threads with enable_rt_hardening
+#define THREAD_STACK_PREFAULT (64 * 1024)  // touched by rt_prefault_stack in real time threads
 #define INPUT_MANAGER_HZ 20
 #define INPUT_MANAGER_PRI 80
 #define INPUT_MANAGER_TOUT 0.5
-#define LOG_MANAGER_HZ 20
+#define LOG_MANAGER_HZ 2  // minimum flush rate, normally woken by log_manager_add_new
 #define LOG_MANAGER_PRI 50
 #define LOG_MANAGER_TOUT 2.0
 #define PRINTF_MANAGER_HZ 20
 #define PRINTF_MANAGER_PRI 60
 #define PRINTF_MANAGER_TOUT 0.5
+#define BLACKBOX_HZ 10  // exit check rate, dumps are triggered by blackbox_trigger
+#define BLACKBOX_PRI 0  // SCHED_OTHER, dumping must never delay flight threads
+#define BLACKBOX_TOUT 2.0
+#define BARO_MANAGER_EXIT_CHECK_HZ 10  // reads are triggered from the IMU interrupt at BMP_HZ
+#define BARO_MANAGER_PRI 85            // above the others so reads aren't stretched, below IMU
+#define BARO_MANAGER_TOUT 0.5
+#define BATTERY_MANAGER_PRI 0  // SCHED_OTHER, runs at settings.battery_sample_hz
+#define BATTERY_MANAGER_TOUT 0.5
 #define BUTTON_EXIT_CHECK_HZ 10
 #define BUTTON_EXIT_TIME_S 2
 
@@ -18,24 +18,92 @@ typedef enum thrust_map_t
     LINEAR_MAP,
     MN1806_1400KV_4S,
     F20_2300KV_2S,
-    RX2206_4S
+    RX2206_4S,
+    CUSTOM_MAP  ///< table given in the settings file
 } thrust_map_t;
 
+#define THRUST_MAP_MAX_POINTS 64  ///< most rows allowed in a custom thrust map
+
 /**
  * @brief      Check the thrust map for validity and populate data arrays.
  *
+ *             The curve is also resampled into a lookup table of lut_points
+ *             even intervals of thrust for map_motor_signal.
+ *
+ * @param[in]  map         The thrust map
+ * @param[in]  lut_points  Number of lookup table intervals
+ *
+ * @return     0 on success, -1 on failure
+ */
+int thrust_map_init(thrust_map_t map, int lut_points);
+
+/**
+ * @brief      Same as thrust_map_init for a table from the settings file.
+ *
+ *             Rows are {signal, thrust} like the built in maps, with the same
+ *             checks. Instead of straight lines between rows the curve is a
+ *             monotone cubic (PCHIP) through them, so a table measured at a
+ *             few points still gives a smooth linearized thrust. The cubic is
+ *             baked into the lookup table so this costs nothing in flight.
+ *
+ * @param[in]  data        {signal, thrust} rows
+ * @param[in]  n           number of rows
+ * @param[in]  lut_points  Number of lookup table intervals
+ *
  * @return     0 on success, -1 on failure
  */
-int thrust_map_init(thrust_map_t map);
+int thrust_map_init_custom(const double (*data)[2], int n, int lut_points);
 
 /**
- * @brief      Corrects the motor signal m for non-linear thrust curve in place.
+ * @brief      Corrects the motor signal m for non-linear thrust curve.
  *
+ *             Constant time lookup in the resampled table, within
+ *             thrust_map_lut_error() of map_motor_signal_exact.
  *
- * @param[in]  m     thrust input, must be between 0 and 1 inclusive
+ * @param[in]  m     thrust input, clamped to between 0 and 1
  *
- * @return     motor signal value on success, -1 on error
+ * @return     motor signal value between 0 and 1
  */
 double map_motor_signal(double m);
 
+/**
+ * @brief      map_motor_signal for n motors at once
+ *
+ * @param[in]  m     thrust inputs
+ * @param[out] out   motor signals
+ * @param[in]  n     number of motors
+ */
+void map_motor_signals(const double* m, double* out, int n);
+
+/**
+ * @brief      Interpolation of the original table points, piecewise linear
+ *             or PCHIP for a custom map, used to build the lookup table and to
+ *             check it.
+ *
+ * @param[in]  m     thrust input, clamped to between 0 and 1
+ *
+ * @return     motor signal value between 0 and 1
+ */
+double map_motor_signal_exact(double m);
+
+/**
+ * @brief      Largest difference between map_motor_signal and
+ *             map_motor_signal_exact for the current map, found by
+ *             thrust_map_init.
+ */
+double thrust_map_lut_error(void);
+
+/**
+ * @brief      Single precision version of map_motor_signals for up to 8 motors
+ *             at once, uses NEON when built for it.
+ *
+ * Inputs are clamped to [0,1] and NaN maps to 0, as in map_motor_signal.
+ * Results agree with map_motor_signal to float precision.
+ *
+ * @param[in]  m     thrust inputs
+ * @param[out] out   motor signals between 0 and 1
+ * @param[in]  n     number of motors, at most 8
+ */
+void map_motor_signals_f32(const float* m, float* out, int n);
+
 #endif  // THRUST_MAP_H
@@ -0,0 +1,118 @@
+/**
+ * <timing.h>
+ *
+ * @brief      Lightweight timing instrumentation of the IMU interrupt.
+ *
+ * Each stage of __imu_isr is timestamped with the monotonic clock and the
+ * execution time added to a log-linear histogram: exact below 16ns, then 16
+ * buckets per power of two which keeps every bucket within about 6% of its
+ * value up to 4 seconds. Histograms are only written from the IMU interrupt and
+ * never reset, readers in other threads may see a sample or two in flight
+ * which doesn't matter for statistics.
+ *
+ * Besides the stages, TIMING_WAKEUP records the delay from the DMP interrupt to
+ * the start of the callback and TIMING_PERIOD the time between consecutive
+ * callbacks, which together show the jitter relative to the DMP interrupt.
+ *
+ * TIMING_SENSOR_TO_MOTOR records how old the gyro data is when the motors get
+ * it, from the DMP interrupt to the pulses sent by feedback_march. It is
+ * written with timing_record.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Things that get a histogram. Stage entries are in the order they run in
+ * __imu_isr.
+ */
+typedef enum timing_stage_t
+{
+    TIMING_WAKEUP,           ///< DMP interrupt to start of the callback
+    TIMING_SETPOINT,         ///< setpoint_manager_update
+    TIMING_ESTIMATOR,        ///< state_estimator_march
+    TIMING_FEEDBACK,         ///< feedback_march
+    TIMING_LOG,              ///< log_manager_add_new, blackbox_add_new, snapshot_publish
+    TIMING_RATE_GROUPS,      ///< sched_tick
+    TIMING_TOTAL,            ///< whole callback
+    TIMING_PERIOD,           ///< start of one callback to the start of the next
+    TIMING_SENSOR_TO_MOTOR,  ///< DMP interrupt to ESC pulses sent by feedback_march
+    TIMING_NUM_STAGES
+} timing_stage_t;
+
+/**
+ * Summary of one histogram, percentiles are the upper edge of the bucket they
+ * fall in so they never under-report.
+ */
+typedef struct timing_stats_t
+{
+    uint32_t count;   ///< number of samples
+    uint32_t min_ns;  ///< smallest sample
+    uint32_t p50_ns;  ///< median
+    uint32_t p99_ns;
+    uint32_t p999_ns;
+    uint32_t max_ns;   ///< largest sample
+    double mean_ns;    ///< average
+} timing_stats_t;
+
+/**
+ * @brief      Mark the start of the IMU callback, must be first in __imu_isr
+ */
+void timing_isr_start(void);
+
+/**
+ * @brief      Record the time since the last mark as the given stage
+ *
+ * @param[in]  stage  The stage that just finished
+ */
+void timing_mark(timing_stage_t stage);
+
+/**
+ * @brief      Record a duration measured elsewhere. Only one thread may record
+ *             to a given stage.
+ *
+ * @param[in]  stage  The stage
+ * @param[in]  ns     The duration in ns
+ */
+void timing_record(timing_stage_t stage, uint64_t ns);
+
+/**
+ * @brief      Stage marked with timing_mark that took longest so far in this
+ *             callback, TIMING_TOTAL if none has been marked yet
+ */
+timing_stage_t timing_slowest_stage(void);
+
+/**
+ * @brief      Record the total time for this callback, must be last in
+ *             __imu_isr
+ *
+ * @return     total execution time of the callback in ns
+ */
+uint64_t timing_isr_end(void);
+
+/**
+ * @brief      Summarize one histogram
+ *
+ * @param[in]  stage  The stage
+ * @param[out] s      The summary
+ *
+ * @return     0 on success, -1 on invalid stage
+ */
+int timing_get_stats(timing_stage_t stage, timing_stats_t* s);
+
+/**
+ * @brief      Short name of a stage for printing and the log file
+ */
+const char* timing_stage_name(timing_stage_t stage);
+
+/**
+ * @brief      Print a table of all stages, used on exit
+ *
+ * @param      fp    stream to print to
+ */
+void timing_print_report(FILE* fp);
+
+#endif  // TIMING_H
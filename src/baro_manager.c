@@ -0,0 +1,203 @@
+/**
+ * @file baro_manager.c
+ */
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <rc/bmp.h>
+#include <rc/mpu.h>
+#include <rc/pthread.h>
+#include <rc/start_stop.h>
+#include <rc/time.h>
+
+#include <baro_manager.h>
+#include <rc_pilot_defs.h>
+#include <rt_harden.h>
+#include <scheduler.h>
+#include <seqlock.h>
+#include <settings.h>
+#include <thread_defs.h>
+
+#define READ_TRIES 2              // torn copies to put up with before giving up this tick
+#define READ_GUARD_NS 1500000ULL  // worst case read, check against the exit report
+#define READ_MARGIN_NS 200000ULL  // DMP interrupt jitter on top of that
+
+static baro_sample_t latest;
+static seqlock_t latest_lock = SEQLOCK_INITIALIZER;
+
+static sem_t wake_sem;
+static atomic_int read_failed;
+
+// only written by the sampler thread, read at exit
+static atomic_uint num_skipped;   // reads skipped because the DMP interrupt was due
+static atomic_uint num_collided;  // reads discarded because the DMP interrupt came during them
+static uint64_t read_max_ns;      // longest read so far, preemption included
+
+static pthread_t pthread;
+static atomic_int running;
+
+/**
+ * @brief      Read the sensor and publish the result
+ *
+ * @param[in]  guard  1 to discard the read if a DMP interrupt came during it,
+ *                    0 when called from the interrupt or before it starts
+ *
+ * @return     0 on success or when discarded, -1 on failure
+ */
+static int __sample(int guard)
+{
+    rc_bmp_data_t data;
+    uint64_t start_ns, read_ns;
+    int64_t since_dmp;
+
+    start_ns = rc_nanos_since_boot();
+    if (rc_bmp_read(&data)) return -1;
+    read_ns = rc_nanos_since_boot() - start_ns;
+    if (read_ns > read_max_ns) read_max_ns = read_ns;
+
+    // the bus transfers may have interleaved with the DMP interrupt's, don't
+    // trust the result
+    since_dmp = rc_mpu_nanos_since_last_dmp_interrupt();
+    if (guard && since_dmp >= 0 && (uint64_t)since_dmp <= read_ns)
+    {
+        atomic_fetch_add(&num_collided, 1);
+        return 0;
+    }
+
+    // only this thread writes latest so it can read it without the lock
+    seqlock_write_begin(&latest_lock);
+    latest.timestamp_ns = rc_nanos_since_boot();
+    latest.count++;
+    latest.pressure_pa = data.pressure_pa;
+    latest.alt_m = data.alt_m;
+    latest.temp_c = data.temp_c;
+    seqlock_write_end(&latest_lock);
+    return 0;
+}
+
+/**
+ * @brief      Whether the DMP interrupt could start before a read would finish.
+ *             The bus lock is only a flag which the DMP interrupt ignores, so
+ *             the read has to stay out of its way by timing alone.
+ *
+ * @return     1 if the read should be skipped, 0 otherwise
+ */
+static int __dmp_due(void)
+{
+    int64_t since_dmp = rc_mpu_nanos_since_last_dmp_interrupt();
+    uint64_t period_ns = 1000000000ULL / settings.feedback_hz;
+
+    // not running yet, nothing to collide with
+    if (since_dmp < 0) return 0;
+    if ((uint64_t)since_dmp + READ_GUARD_NS + READ_MARGIN_NS < period_ns) return 0;
+    atomic_fetch_add(&num_skipped, 1);
+    return 1;
+}
+
+static void* __baro_manager_func(__attribute__((unused)) void* ptr)
+{
+    struct timespec ts;
+
+    rt_prefault_stack();
+    while (rc_get_state() != EXITING && atomic_load(&running))
+    {
+        // time out every so often to check if we should exit
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000000 / BARO_MANAGER_EXIT_CHECK_HZ;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        if (sem_timedwait(&wake_sem, &ts) != 0) continue;
+
+        // on a skipped or bad read just try again next time
+        if (__dmp_due()) continue;
+        atomic_store(&read_failed, __sample(1) < 0);
+    }
+
+    atomic_store(&running, 0);
+    return NULL;
+}
+
+/**
+ * @brief      Rate group task, wakes the sampler right after the control loop
+ *             so the read happens while the bus is quiet
+ *
+ * @return     0, or -1 if the previous read failed
+ */
+static int __request(void)
+{
+#ifdef BARO_SYNC
+    // read in the interrupt like before, only to compare callback timing
+    return __sample(0);
+#else
+    sem_post(&wake_sem);
+    return atomic_exchange(&read_failed, 0) ? -1 : 0;
+#endif
+}
+
+int baro_manager_init(void)
+{
+    if (atomic_load(&running))
+    {
+        fprintf(stderr, "ERROR in baro_manager_init, already running\n");
+        return -1;
+    }
+
+    // state estimator needs a sample to start the altitude filter from
+    if (__sample(0) < 0)
+    {
+        fprintf(stderr, "ERROR in baro_manager_init, failed to read barometer\n");
+        return -1;
+    }
+
+    atomic_store(&read_failed, 0);
+    sem_init(&wake_sem, 0, 0);
+    atomic_store(&running, 1);
+
+    if (rc_pthread_create(&pthread, __baro_manager_func, NULL, SCHED_FIFO, BARO_MANAGER_PRI) < 0)
+    {
+        fprintf(stderr, "ERROR in baro_manager_init, failed to start thread\n");
+        atomic_store(&running, 0);
+        return -1;
+    }
+    if (sched_add("barometer", __request, BMP_HZ, SCHED_AUTO_PHASE) < 0) return -1;
+    return 0;
+}
+
+int baro_manager_get_latest(baro_sample_t* s)
+{
+    baro_sample_t tmp;
+
+    if (seqlock_read(&latest_lock, &tmp, &latest, sizeof(tmp), READ_TRIES)) return -1;
+    *s = tmp;
+    return 0;
+}
+
+void baro_manager_print_report(FILE* fp)
+{
+    fprintf(fp, "\nbarometer: %u reads skipped with the DMP interrupt due, ",
+        atomic_load(&num_skipped));
+    fprintf(fp, "%u discarded after it came mid-read, longest read %.1fus\n",
+        atomic_load(&num_collided), read_max_ns / 1e3);
+}
+
+int baro_manager_cleanup(void)
+{
+    int ret;
+
+    if (atomic_load(&running) == 0) return 0;
+
+    atomic_store(&running, 0);
+    sem_post(&wake_sem);
+    ret = rc_pthread_timed_join(pthread, NULL, BARO_MANAGER_TOUT);
+    if (ret == 1)
+        fprintf(stderr, "WARNING: baro_manager thread exit timeout\n");
+    else if (ret == -1)
+        fprintf(stderr, "ERROR: failed to join baro_manager thread\n");
+    return ret;
+}
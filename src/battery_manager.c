@@ -0,0 +1,147 @@
+/**
+ * @file battery_manager.c
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include <rc/adc.h>
+#include <rc/math/filter.h>
+#include <rc/pthread.h>
+#include <rc/start_stop.h>
+#include <rc/time.h>
+
+#include <battery_manager.h>
+#include <rc_pilot_defs.h>
+#include <seqlock.h>
+#include <settings.h>
+#include <thread_defs.h>
+
+#define BATT_LP_TC 0.1      // seconds, filter for gain compensation
+#define BATT_REST_TC 5.0    // seconds, slow filter the sag is measured from
+#define BATT_SAG_FRAC 0.05  // sag when v_lp drops this fraction of v_nominal below rest
+#define READ_TRIES 2        // torn copies to put up with before giving up
+
+static rc_filter_t batt_lp = RC_FILTER_INITIALIZER;
+static rc_filter_t batt_rest = RC_FILTER_INITIALIZER;
+
+static battery_sample_t latest;
+static seqlock_t latest_lock = SEQLOCK_INITIALIZER;
+
+static pthread_t pthread;
+static atomic_int running;
+
+/**
+ * @brief      Read the barrel jack, falls back to v_nominal with nothing
+ *             plugged in
+ */
+static double __read(void)
+{
+    double v = rc_adc_dc_jack();
+    if (v < 3.0) v = settings.v_nominal;
+    return v;
+}
+
+/**
+ * @brief      Filter a new reading and publish the result
+ */
+static void __update(double v)
+{
+    battery_sample_t s;
+
+    s.v_raw = v;
+    s.v_lp = rc_filter_march(&batt_lp, v);
+    s.comp = settings.v_nominal / s.v_lp;
+    s.sag = s.v_lp < rc_filter_march(&batt_rest, v) - BATT_SAG_FRAC * settings.v_nominal;
+
+    if (s.sag && !latest.sag && settings.warnings_en)
+    {
+        fprintf(stderr, "WARNING: battery sagging to %0.2fV\n", s.v_lp);
+    }
+
+    seqlock_write(&latest_lock, &latest, &s, sizeof(s));
+}
+
+static void* __battery_manager_func(__attribute__((unused)) void* ptr)
+{
+    while (rc_get_state() != EXITING && atomic_load(&running))
+    {
+        __update(__read());
+        rc_usleep(1000000 / settings.battery_sample_hz);
+    }
+
+    atomic_store(&running, 0);
+    return NULL;
+}
+
+int battery_manager_init(void)
+{
+    double dt, v;
+
+    if (atomic_load(&running))
+    {
+        fprintf(stderr, "ERROR in battery_manager_init, already running\n");
+        return -1;
+    }
+
+    dt = 1.0 / settings.battery_sample_hz;
+    if (rc_filter_first_order_lowpass(&batt_lp, dt, BATT_LP_TC) ||
+        rc_filter_first_order_lowpass(&batt_rest, dt, BATT_REST_TC))
+    {
+        fprintf(stderr, "ERROR in battery_manager_init, failed to make filters\n");
+        return -1;
+    }
+
+    // start the filters from the first reading so nothing ramps up
+    v = rc_adc_dc_jack();
+    if (v < 3.0 && settings.warnings_en)
+    {
+        fprintf(stderr, "WARNING: ADC read %0.1fV on the barrel jack. Please connect\n", v);
+        fprintf(stderr, "battery to barrel jack, assuming nominal voltage for now.\n");
+    }
+    v = __read();
+    rc_filter_prefill_inputs(&batt_lp, v);
+    rc_filter_prefill_outputs(&batt_lp, v);
+    rc_filter_prefill_inputs(&batt_rest, v);
+    rc_filter_prefill_outputs(&batt_rest, v);
+    __update(v);
+
+    atomic_store(&running, 1);
+    if (rc_pthread_create(&pthread, __battery_manager_func, NULL, SCHED_OTHER,
+            BATTERY_MANAGER_PRI) < 0)
+    {
+        fprintf(stderr, "ERROR in battery_manager_init, failed to start thread\n");
+        atomic_store(&running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+int battery_manager_get_latest(battery_sample_t* s)
+{
+    battery_sample_t tmp;
+
+    if (seqlock_read(&latest_lock, &tmp, &latest, sizeof(tmp), READ_TRIES)) return -1;
+    *s = tmp;
+    return 0;
+}
+
+int battery_manager_cleanup(void)
+{
+    int ret;
+
+    if (atomic_load(&running) == 0) return 0;
+
+    atomic_store(&running, 0);
+    ret = rc_pthread_timed_join(pthread, NULL, BATTERY_MANAGER_TOUT);
+    if (ret == 1)
+        fprintf(stderr, "WARNING: battery_manager thread exit timeout\n");
+    else if (ret == -1)
+        fprintf(stderr, "ERROR: failed to join battery_manager thread\n");
+    if (ret == 0)
+    {
+        rc_filter_free(&batt_lp);
+        rc_filter_free(&batt_rest);
+    }
+    return ret;
+}
@@ -0,0 +1,365 @@
+/**
+ * @file blackbox.c
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rc/pthread.h>
+#include <rc/start_stop.h>
+#include <rc/time.h>
+
+#include <blackbox.h>
+#include <log_fields.h>
+#include <log_format.h>
+#include <rc_pilot_defs.h>
+#include <rt_harden.h>
+#include <settings.h>
+#include <thread_defs.h>
+
+#define POST_TRIGGER_S 1.0  // keep recording this long after a trigger, at most half the ring
+#define DUMP_PREFIX "blackbox_"
+
+static const char* event_names[BLACKBOX_NUM_EVENTS] = {
+    "tipover", "kill_switch", "overrun", "sensor_fault"};
+
+// every field in the table, regardless of the log_* settings
+static log_fields_t layout;
+
+/*
+ * Ring of captured entries, layout.num values each. Only the IMU interrupt
+ * writes head and it never waits on the reader, the oldest entry is simply
+ * overwritten. The dump thread copies the ring and then checks head again to
+ * throw away anything that was overwritten while it was copying.
+ */
+static uint64_t* ring;
+static uint32_t ring_len;
+static uint32_t ring_mask;
+static atomic_uint ring_head;
+
+// dump is packed here so nothing is allocated when something has gone wrong
+static char* dump_buf;
+static size_t dump_buf_len;
+
+// -1 when idle, otherwise the blackbox_event_t waiting to be dumped, or
+// HOLDOFF while triggers are being ignored after a dump
+#define HOLDOFF BLACKBOX_NUM_EVENTS
+static atomic_int pending_event;
+static sem_t wake_sem;
+
+static pthread_t pthread;
+static atomic_int running;
+
+// number of the next dump, dumps are numbered so the oldest can be found
+// even when the clock was reset between flights
+static int next_seq;
+
+/**
+ * @brief      Number of a dump file from its name
+ *
+ * @return     the number, or -1 if the name isn't a numbered dump
+ */
+static int __dump_seq(const char* name)
+{
+    int seq;
+    char date[9], tod[7];
+    size_t len = strlen(name);
+
+    if (len < sizeof(LOG_FILE_EXT) || strcmp(name + len - strlen(LOG_FILE_EXT), LOG_FILE_EXT))
+        return -1;
+    if (sscanf(name, DUMP_PREFIX "%d_%8[0-9]_%6[0-9]_", &seq, date, tod) != 3) return -1;
+    return seq < 0 ? -1 : seq;
+}
+
+/**
+ * @brief      Count the dumps in LOG_DIR and find the oldest one
+ *
+ * @param[out] oldest  name of the lowest numbered dump
+ * @param[out] newest  highest number in use, -1 if there are none
+ *
+ * @return     number of dumps
+ */
+static int __scan_dumps(char* oldest, size_t len, int* newest)
+{
+    DIR* dir;
+    struct dirent* ent;
+    int seq, lowest = -1, num = 0;
+
+    *newest = -1;
+    dir = opendir(LOG_DIR);
+    if (dir == NULL) return 0;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        seq = __dump_seq(ent->d_name);
+        if (seq < 0) continue;
+        num++;
+        if (seq > *newest) *newest = seq;
+        if (lowest == -1 || seq < lowest)
+        {
+            lowest = seq;
+            snprintf(oldest, len, "%s", ent->d_name);
+        }
+    }
+    closedir(dir);
+    return num;
+}
+
+/**
+ * @brief      Delete the oldest dumps until at most blackbox_max_files are
+ *             left, so repeated triggers can't fill the card
+ */
+static void __enforce_retention(void)
+{
+    char name[NAME_MAX + 1];
+    char path[sizeof(LOG_DIR) + NAME_MAX];
+    int newest;
+
+    if (settings.blackbox_max_files == 0) return;
+    while (__scan_dumps(name, sizeof(name), &newest) > settings.blackbox_max_files)
+    {
+        snprintf(path, sizeof(path), LOG_DIR "%s", name);
+        if (unlink(path) == -1)
+        {
+            fprintf(stderr, "ERROR in blackbox, failed to delete %s\n", path);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief      Copy the ring out and write it to a new file.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __dump(blackbox_event_t event)
+{
+    uint32_t head, first, n, i, lost;
+    char* p;
+    char* start;
+    char path[100];
+    char stamp[32];
+    time_t now;
+    log_trailer_t t;
+    int fd;
+    size_t len;
+
+    head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    n = head < ring_len ? head : ring_len;
+    first = head - n;
+
+    // pack oldest to newest behind the header
+    p = dump_buf + log_fields_header_len(&layout);
+    for (i = first; i != head; i++)
+    {
+        *p++ = (char)LOG_RECORD_ENTRY;
+        memcpy(p, &ring[(size_t)(i & ring_mask) * layout.num], layout.num * sizeof(uint64_t));
+        p += layout.num * sizeof(uint64_t);
+    }
+
+    // the interrupt kept going while we copied, entries it has since written
+    // over (and the one it may be writing now) are no longer trustworthy
+    head = atomic_load_explicit(&ring_head, memory_order_acquire);
+    lost = 0;
+    if (head - first + 1 > ring_len) lost = head - first + 1 - ring_len;
+    if (lost > n) lost = n;
+    n -= lost;
+
+    // header goes right before the first good record
+    start = dump_buf + (size_t)lost * layout.record_len;
+    log_fields_write_header(&layout, start);
+
+    memset(&t, 0, sizeof(t));
+    t.num_entries = n;
+    t.buffer_len = ring_len;
+    *p++ = (char)LOG_RECORD_TRAILER;
+    memcpy(p, &t, sizeof(t));
+    p += sizeof(t);
+    len = p - start;
+
+    now = time(NULL);
+    strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", localtime(&now));
+    sprintf(path, LOG_DIR DUMP_PREFIX "%d_%s_%s" LOG_FILE_EXT, next_seq++, stamp,
+        event_names[event]);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        fprintf(stderr, "ERROR in blackbox, can't open %s\n", path);
+        return -1;
+    }
+    if (write(fd, start, len) != (ssize_t)len)
+    {
+        fprintf(stderr, "ERROR in blackbox, failed to write %s\n", path);
+        close(fd);
+        return -1;
+    }
+    fsync(fd);
+    close(fd);
+    printf("blackbox: %s, wrote %u entries to %s\n", event_names[event], n, path);
+    __enforce_retention();
+    return 0;
+}
+
+/**
+ * @brief      Sleep in short steps so shutdown isn't held up
+ *
+ * @return     0 if the full time passed, -1 if the thread should exit
+ */
+static int __wait(double seconds)
+{
+    uint64_t end = rc_nanos_since_boot() + (uint64_t)(seconds * 1e9);
+    while (rc_nanos_since_boot() < end)
+    {
+        if (rc_get_state() == EXITING || !atomic_load(&running)) return -1;
+        rc_usleep(1000000 / BLACKBOX_HZ);
+    }
+    return 0;
+}
+
+static void* __blackbox_func(__attribute__((unused)) void* ptr)
+{
+    struct timespec ts;
+    int event;
+    double window = (double)ring_len / settings.feedback_hz;
+    double post = POST_TRIGGER_S < window / 2 ? POST_TRIGGER_S : window / 2;
+
+    while (rc_get_state() != EXITING && atomic_load(&running))
+    {
+        // time out every so often to check if we should exit
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000000 / BLACKBOX_HZ;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        sem_timedwait(&wake_sem, &ts);
+
+        event = atomic_load(&pending_event);
+        if (event < 0) continue;
+
+        // let the ring fill with what happened after the event, on shutdown
+        // dump straight away with what we have
+        if (__wait(post) == -1) break;
+        __dump(event);
+
+        // anything triggered before the ring has turned over would mostly
+        // repeat this dump, keep ignoring triggers until then
+        atomic_store(&pending_event, HOLDOFF);
+        if (__wait(window - post) == -1) break;
+        atomic_store(&pending_event, -1);
+    }
+
+    // don't lose an event that came in right before shutdown
+    event = atomic_exchange(&pending_event, HOLDOFF);
+    if (event >= 0 && event < HOLDOFF) __dump(event);
+
+    atomic_store(&running, 0);
+    return NULL;
+}
+
+int blackbox_init(void)
+{
+    struct stat st = {0};
+    char name[NAME_MAX + 1];
+
+    if (atomic_load(&running))
+    {
+        fprintf(stderr, "ERROR in blackbox_init, already running\n");
+        return -1;
+    }
+
+    // dumps go next to the regular logs
+    if (stat(LOG_DIR, &st) == -1)
+    {
+        mkdir(LOG_DIR, 0755);
+    }
+    __scan_dumps(name, sizeof(name), &next_seq);
+    next_seq++;
+
+    log_fields_init(&layout, (1 << LOG_NUM_GROUPS) - 1);
+
+    // ring depth rounded up to a power of two so counters can wrap freely
+    ring_len = 1;
+    while (ring_len < (uint32_t)(settings.blackbox_seconds * settings.feedback_hz)) ring_len <<= 1;
+    ring_mask = ring_len - 1;
+    ring = (uint64_t*)calloc((size_t)ring_len * layout.num, sizeof(uint64_t));
+    dump_buf_len = log_fields_header_len(&layout) + (size_t)ring_len * layout.record_len + 1 +
+                   sizeof(log_trailer_t);
+    dump_buf = (char*)malloc(dump_buf_len);
+    if (ring == NULL || dump_buf == NULL)
+    {
+        fprintf(stderr, "ERROR in blackbox_init, failed to allocate %zu bytes\n",
+            (size_t)ring_len * layout.num * sizeof(uint64_t) + dump_buf_len);
+        free(ring);
+        free(dump_buf);
+        ring = NULL;
+        dump_buf = NULL;
+        return -1;
+    }
+    rt_prefault(ring, (size_t)ring_len * layout.num * sizeof(uint64_t));
+
+    atomic_store(&ring_head, 0);
+    atomic_store(&pending_event, -1);
+    sem_init(&wake_sem, 0, 0);
+    atomic_store(&running, 1);
+
+    if (rc_pthread_create(&pthread, __blackbox_func, NULL, SCHED_OTHER, BLACKBOX_PRI) < 0)
+    {
+        fprintf(stderr, "ERROR in blackbox_init, failed to start thread\n");
+        atomic_store(&running, 0);
+        return -1;
+    }
+    return 0;
+}
+
+int blackbox_add_new(void)
+{
+    uint32_t head;
+
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) return -1;
+
+    head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    log_fields_capture(&layout, &ring[(size_t)(head & ring_mask) * layout.num]);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+    return 0;
+}
+
+int blackbox_trigger(blackbox_event_t event)
+{
+    int idle = -1;
+
+    if (!atomic_load_explicit(&running, memory_order_relaxed)) return -1;
+    if (event < 0 || event >= BLACKBOX_NUM_EVENTS) return -1;
+
+    // first event wins, the dump thread clears this when it's ready again
+    if (!atomic_compare_exchange_strong(&pending_event, &idle, event)) return -1;
+    sem_post(&wake_sem);
+    return 0;
+}
+
+int blackbox_cleanup(void)
+{
+    int ret;
+
+    if (atomic_load(&running) == 0) return 0;
+
+    atomic_store(&running, 0);
+    sem_post(&wake_sem);
+    ret = rc_pthread_timed_join(pthread, NULL, BLACKBOX_TOUT);
+    if (ret == 1)
+        fprintf(stderr, "WARNING: blackbox thread exit timeout\n");
+    else if (ret == -1)
+        fprintf(stderr, "ERROR: failed to join blackbox thread\n");
+    return ret;
+}
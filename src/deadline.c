@@ -0,0 +1,141 @@
+/**
+ * @file deadline.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deadline.h>
+#include <settings.h>
+#include <snapshot.h>
+#include <timing.h>
+
+#define DEADLINE_WINDOW_MS 250  // overruns are counted over windows this long
+#define DEGRADE_OVERRUNS 3      // overruns within one window that shed the next level
+#define RECOVER_WINDOWS 8       // windows in a row without an overrun to restore a level
+#define LOG_DECIMATION 4        // log every this many entries in DEGRADE_LOG_DECIMATE
+
+deadline_state_t deadline;
+
+static const char* level_names[DEGRADE_NUM_LEVELS] = {
+    "none", "log_decimate", "skip_mag", "pause_printf"};
+
+static uint64_t budget_ns;
+static int window_len;  // ticks per window
+static int window_ticks;
+static int window_overruns;
+static int clean_windows;
+static int log_ticks;
+static uint32_t stage_overruns[TIMING_NUM_STAGES];
+
+// last state seen by deadline_print_events, only used by the main thread
+static uint64_t printed_events;
+
+static void __set_level(degrade_level_t level)
+{
+    deadline.level = level;
+    deadline.events++;
+    if (deadline.level > deadline.max_level) deadline.max_level = deadline.level;
+    window_overruns = 0;
+    clean_windows = 0;
+}
+
+int deadline_init(void)
+{
+    if (settings.feedback_hz <= 0)
+    {
+        fprintf(stderr, "ERROR in deadline_init, feedback_hz not set\n");
+        return -1;
+    }
+    budget_ns = 1000000000ULL / settings.feedback_hz;
+    window_len = settings.feedback_hz * DEADLINE_WINDOW_MS / 1000;
+    if (window_len < 1) window_len = 1;
+    deadline.last_stage = TIMING_TOTAL;
+    return 0;
+}
+
+int deadline_check(uint64_t total_ns)
+{
+    int overrun = total_ns > budget_ns;
+
+    if (overrun)
+    {
+        deadline.overruns++;
+        deadline.last_total_ns = total_ns;
+        deadline.last_stage = timing_slowest_stage();
+        stage_overruns[deadline.last_stage]++;
+        window_overruns++;
+
+        // shed the next level straight away, waiting for the window to end
+        // would let a stuck stage overrun the whole window
+        if (settings.enable_degradation && window_overruns >= DEGRADE_OVERRUNS &&
+            deadline.level < DEGRADE_NUM_LEVELS - 1)
+        {
+            __set_level(deadline.level + 1);
+        }
+    }
+
+    if (++window_ticks < window_len) return overrun;
+    window_ticks = 0;
+    if (window_overruns == 0)
+        clean_windows++;
+    else
+        clean_windows = 0;
+    window_overruns = 0;
+    if (clean_windows >= RECOVER_WINDOWS && deadline.level > DEGRADE_NONE)
+    {
+        __set_level(deadline.level - 1);
+    }
+    return overrun;
+}
+
+int deadline_log_due(void)
+{
+    if (deadline.level < DEGRADE_LOG_DECIMATE)
+    {
+        log_ticks = 0;
+        return 1;
+    }
+    if (log_ticks++ % LOG_DECIMATION == 0) return 1;
+    return 0;
+}
+
+uint32_t deadline_stage_overruns(timing_stage_t stage)
+{
+    if (stage < 0 || stage >= TIMING_NUM_STAGES) return 0;
+    return stage_overruns[stage];
+}
+
+const char* deadline_level_name(degrade_level_t level)
+{
+    if (level < 0 || level >= DEGRADE_NUM_LEVELS) return "unknown";
+    return level_names[level];
+}
+
+void deadline_print_events(FILE* fp)
+{
+    snapshot_t snap;
+
+    if (snapshot_get(&snap) == -1) return;
+    if (snap.deadline.events == printed_events) return;
+    printed_events = snap.deadline.events;
+    fprintf(fp, "WARNING: degrade level now %s, ", deadline_level_name(snap.deadline.level));
+    fprintf(fp, "%llu IMU callback overruns so far, last %.1fus mostly in %s\n",
+        (unsigned long long)snap.deadline.overruns, snap.deadline.last_total_ns / 1e3,
+        timing_stage_name(snap.deadline.last_stage));
+}
+
+void deadline_print_report(FILE* fp)
+{
+    int i;
+
+    fprintf(fp, "\nIMU callback overruns, budget %.1fus\n", budget_ns / 1e3);
+    fprintf(fp, "%-11s %9llu\n", "total", (unsigned long long)deadline.overruns);
+    for (i = 0; i < TIMING_NUM_STAGES; i++)
+    {
+        if (stage_overruns[i] == 0) continue;
+        fprintf(fp, "%-11s %9u\n", timing_stage_name(i), stage_overruns[i]);
+    }
+    fprintf(fp, "%llu degrade level changes, highest %s\n", (unsigned long long)deadline.events,
+        deadline_level_name(deadline.max_level));
+}
@@ -13,8 +13,10 @@
 #include <rc/servo.h>
 #include <rc/start_stop.h>
 #include <rc/time.h>
+#include <stdatomic.h>
 #include <stdio.h>
 
+#include <blackbox.h>
 #include <feedback.h>
 #include <log_manager.h>
 #include <mix.h>
@@ -23,6 +25,7 @@
 #include <settings.h>
 #include <state_estimator.h>
 #include <thrust_map.h>
+#include <timing.h>
 
 #define TWO_PI (M_PI * 2.0)
 
@@ -44,6 +47,19 @@ static rc_filter_t D_Ydot_4 = RC_FILTER_INITIALIZER;
 static rc_filter_t D_Ydot_6 = RC_FILTER_INITIALIZER;
 static rc_filter_t D_Y_4 = RC_FILTER_INITIALIZER;
 static rc_filter_t D_Y_6 = RC_FILTER_INITIALIZER;
+static rc_filter_t Xdot_lp = RC_FILTER_INITIALIZER;
+static rc_filter_t Ydot_lp = RC_FILTER_INITIALIZER;
+
+// horizontal cascade state, restarted whenever it's switched on
+static int last_en_XY_ctrl = 0;
+static int XY_count;
+static double XY_last_pos[2];
+
+// counted in the IMU interrupt, printed by feedback_print_events
+static atomic_uint tipover_events;
+static atomic_uint rearm_events;
+static unsigned int printed_tipovers, printed_rearms;
+static int tipped;
 
 static int __send_motor_stop_pulse(void)
 {
@@ -105,16 +121,18 @@ int feedback_disarm(void)
 
 int feedback_arm(void)
 {
+    uint64_t start_ns = rc_nanos_since_boot();
+
     if (fstate.arm_state == ARMED)
     {
-        printf("WARNING: trying to arm when controller is already armed\n");
+        atomic_fetch_add_explicit(&rearm_events, 1, memory_order_relaxed);
         return -1;
     }
-    // start a new log file every time controller is armed, this may take some
-    // time so do it before touching anything else
-    if (settings.enable_logging) log_manager_init();
+    // start a new log file every time controller is armed. The log manager
+    // has the file open already so this just flags the handoff.
+    if (settings.enable_logging) log_manager_new_segment();
     // get the current time
-    fstate.arm_time_ns = rc_nanos_since_boot();
+    fstate.arm_time_ns = start_ns;
     // reset the index
     fstate.loop_index = 0;
     // when swapping from direct throttle to altitude control, the altitude
@@ -131,6 +149,7 @@ int feedback_arm(void)
     rc_filter_reset(&D_pitch);
     rc_filter_reset(&D_yaw);
     rc_filter_reset(&D_Z);
+    last_en_XY_ctrl = 0;
 
     // prefill filters with current error
     rc_filter_prefill_inputs(&D_roll, -state_estimate.roll);
@@ -140,6 +159,7 @@ int feedback_arm(void)
     rc_led_set(RC_LED_GREEN, 1);
     // last thing is to flag as armed
     fstate.arm_state = ARMED;
+    fstate.arm_duration_ns = rc_nanos_since_boot() - start_ns;
     return 0;
 }
 
@@ -159,6 +179,22 @@ int feedback_init(void)
     rc_filter_duplicate(&D_Y_4, settings.horiz_pos_ctrl_4dof);
     rc_filter_duplicate(&D_Y_6, settings.horiz_pos_ctrl_6dof);
 
+    // velocity controllers command tilt in 4DOF and X/Y thrust in 6DOF, the
+    // position controllers a velocity setpoint. Velocity comes from
+    // differentiating mocap position at the outer loop rate.
+    rc_filter_enable_saturation(&D_Xdot_4, -MAX_PITCH_SETPOINT, MAX_PITCH_SETPOINT);
+    rc_filter_enable_saturation(&D_Ydot_4, -MAX_ROLL_SETPOINT, MAX_ROLL_SETPOINT);
+    rc_filter_enable_saturation(&D_Xdot_6, -MAX_X_COMPONENT, MAX_X_COMPONENT);
+    rc_filter_enable_saturation(&D_Ydot_6, -MAX_Y_COMPONENT, MAX_Y_COMPONENT);
+    rc_filter_enable_saturation(&D_X_4, -settings.max_XY_velocity, settings.max_XY_velocity);
+    rc_filter_enable_saturation(&D_Y_4, -settings.max_XY_velocity, settings.max_XY_velocity);
+    rc_filter_enable_saturation(&D_X_6, -settings.max_XY_velocity, settings.max_XY_velocity);
+    rc_filter_enable_saturation(&D_Y_6, -settings.max_XY_velocity, settings.max_XY_velocity);
+    rc_filter_first_order_lowpass(
+        &Xdot_lp, settings.dt * settings.horiz_ctrl_divisor, 1.0 / XY_VEL_CUTOFF_FREQ);
+    rc_filter_first_order_lowpass(
+        &Ydot_lp, settings.dt * settings.horiz_ctrl_divisor, 1.0 / XY_VEL_CUTOFF_FREQ);
+
 #ifdef DEBUG
     printf("ALTITUDE CONTROLLER:\n");
     rc_filter_print(D_Z);
@@ -175,12 +211,238 @@ int feedback_init(void)
     return 0;
 }
 
+// roll, pitch and yaw errors for the attitude controllers, set each loop by
+// __attitude_error
+static double att_err[3];
+
+/**
+ * @brief      sin and cos of half an angle without libm trig. The angle is
+ *             wrapped to +-pi first so the series only see +-pi/2 where they
+ *             are good to about 1e-7.
+ */
+static inline void __sincos_half(double a, double* s, double* c)
+{
+    double x = 0.5 * (a - TWO_PI * floor(a / TWO_PI + 0.5));
+    double x2 = x * x;
+
+    *s = x * (1.0 + x2 * (-1.0 / 6.0 + x2 * (1.0 / 120.0 + x2 * (-1.0 / 5040.0 +
+                                                x2 * (1.0 / 362880.0 - x2 / 39916800.0)))));
+    *c = 1.0 + x2 * (-0.5 + x2 * (1.0 / 24.0 + x2 * (-1.0 / 720.0 + x2 * (1.0 / 40320.0 +
+                                                x2 * (-1.0 / 3628800.0 + x2 / 479001600.0)))));
+}
+
+/**
+ * @brief      Cosine of the angle between body Z and vertical, the Z component
+ *             of gravity rotated into the body frame. Same as
+ *             cos(roll)*cos(pitch) but straight from the quaternion.
+ */
+static inline double __tilt_cos(void)
+{
+    const double* q = state_estimate.quat;
+    return 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]);
+}
+
+/**
+ * @brief      Attitude error from the quaternion error between the current
+ *             attitude and the setpoint.
+ *
+ * The error quaternion is the rotation from where we are to the setpoint in
+ * the body frame, taken the short way round, and twice its vector part gives
+ * roll, pitch and yaw errors that match setpoint minus state for small angles.
+ * Unlike differences of Tait-Bryan angles this has no jump when yaw wraps past
+ * +-pi and stays well defined near 90 degrees of pitch.
+ */
+static void __attitude_error(void)
+{
+    const double* q = state_estimate.quat;
+    double sr, cr, sp, cp, sy, cy;
+    double qs[4], w, x, y, z;
+
+    // setpoint quaternion, same Z-Y-X order as rc_quaternion_to_tb_array
+    __sincos_half(setpoint.roll, &sr, &cr);
+    __sincos_half(setpoint.pitch, &sp, &cp);
+    __sincos_half(setpoint.yaw, &sy, &cy);
+    qs[0] = cr * cp * cy + sr * sp * sy;
+    qs[1] = sr * cp * cy - cr * sp * sy;
+    qs[2] = cr * sp * cy + sr * cp * sy;
+    qs[3] = cr * cp * sy - sr * sp * cy;
+
+    // conjugate(q) * qs
+    w = q[0] * qs[0] + q[1] * qs[1] + q[2] * qs[2] + q[3] * qs[3];
+    x = q[0] * qs[1] - q[1] * qs[0] - q[2] * qs[3] + q[3] * qs[2];
+    y = q[0] * qs[2] - q[2] * qs[0] - q[3] * qs[1] + q[1] * qs[3];
+    z = q[0] * qs[3] - q[3] * qs[0] - q[1] * qs[2] + q[2] * qs[1];
+    if (w < 0.0)
+    {
+        x = -x;
+        y = -y;
+        z = -z;
+    }
+    att_err[0] = 2.0 * x;
+    att_err[1] = 2.0 * y;
+    att_err[2] = 2.0 * z;
+}
+
+/**
+ * @brief      Horizontal position and velocity cascade.
+ *
+ * Runs once every settings.horiz_ctrl_divisor calls and holds its output in
+ * between, so the inner loop only pays for it at the outer loop rate. The
+ * position loop turns the mocap position error into a velocity setpoint on top
+ * of the stick velocity, the velocity loop turns the velocity error into roll
+ * and pitch setpoints (4DOF) or X and Y thrust (6DOF) for the inner loop, both
+ * rotated from the mocap frame into the heading frame. Without mocap the
+ * vehicle is held level and the cascade restarts when mocap returns.
+ */
+static void __march_XY(void)
+{
+    rc_filter_t *D_X, *D_Y, *D_Xdot, *D_Ydot;
+    const double* q = state_estimate.quat;
+    double dt = settings.dt * settings.horiz_ctrl_divisor;
+    double vel[2], vel_sp[2], cmd[2];
+    double c, s, n, fwd, right;
+
+    if (setpoint.en_6dof)
+    {
+        D_X = &D_X_6;
+        D_Y = &D_Y_6;
+        D_Xdot = &D_Xdot_6;
+        D_Ydot = &D_Ydot_6;
+    }
+    else
+    {
+        D_X = &D_X_4;
+        D_Y = &D_Y_4;
+        D_Xdot = &D_Xdot_4;
+        D_Ydot = &D_Ydot_4;
+    }
+
+    if (!state_estimate.mocap_running)
+    {
+        setpoint.roll = 0.0;
+        setpoint.pitch = 0.0;
+        if (setpoint.en_6dof)
+        {
+            setpoint.X_throttle = 0.0;
+            setpoint.Y_throttle = 0.0;
+        }
+        last_en_XY_ctrl = 0;
+        return;
+    }
+
+    // start from rest and run straight away
+    if (last_en_XY_ctrl == 0)
+    {
+        rc_filter_reset(D_X);
+        rc_filter_reset(D_Y);
+        rc_filter_reset(D_Xdot);
+        rc_filter_reset(D_Ydot);
+        rc_filter_reset(&Xdot_lp);
+        rc_filter_reset(&Ydot_lp);
+        XY_last_pos[0] = state_estimate.X;
+        XY_last_pos[1] = state_estimate.Y;
+        XY_count = settings.horiz_ctrl_divisor - 1;
+        last_en_XY_ctrl = 1;
+    }
+    if (++XY_count < settings.horiz_ctrl_divisor) return;
+    XY_count = 0;
+
+    vel[0] = rc_filter_march(&Xdot_lp, (state_estimate.X - XY_last_pos[0]) / dt);
+    vel[1] = rc_filter_march(&Ydot_lp, (state_estimate.Y - XY_last_pos[1]) / dt);
+    XY_last_pos[0] = state_estimate.X;
+    XY_last_pos[1] = state_estimate.Y;
+
+    vel_sp[0] = setpoint.X_dot;
+    vel_sp[1] = setpoint.Y_dot;
+    if (setpoint.en_XY_pos_ctrl)
+    {
+        vel_sp[0] += rc_filter_march(D_X, setpoint.X - state_estimate.X);
+        vel_sp[1] += rc_filter_march(D_Y, setpoint.Y - state_estimate.Y);
+        rc_saturate_double(&vel_sp[0], -settings.max_XY_velocity, settings.max_XY_velocity);
+        rc_saturate_double(&vel_sp[1], -settings.max_XY_velocity, settings.max_XY_velocity);
+    }
+    cmd[0] = rc_filter_march(D_Xdot, vel_sp[0] - vel[0]);
+    cmd[1] = rc_filter_march(D_Ydot, vel_sp[1] - vel[1]);
+
+    // heading from the quaternion, the first column of the rotation matrix
+    // projected onto the horizontal plane
+    c = 1.0 - 2.0 * (q[2] * q[2] + q[3] * q[3]);
+    s = 2.0 * (q[0] * q[3] + q[1] * q[2]);
+    n = sqrt(c * c + s * s);
+    if (n > 1e-6)
+    {
+        c /= n;
+        s /= n;
+    }
+    fwd = c * cmd[0] + s * cmd[1];
+    right = -s * cmd[0] + c * cmd[1];
+
+    if (setpoint.en_6dof)
+    {
+        setpoint.X_throttle = fwd;
+        setpoint.Y_throttle = right;
+        rc_saturate_double(&setpoint.X_throttle, -MAX_X_COMPONENT, MAX_X_COMPONENT);
+        rc_saturate_double(&setpoint.Y_throttle, -MAX_Y_COMPONENT, MAX_Y_COMPONENT);
+    }
+    else
+    {
+        // tip forward to go forward, right to go right
+        setpoint.pitch = -fwd;
+        setpoint.roll = right;
+        rc_saturate_double(&setpoint.pitch, -MAX_PITCH_SETPOINT, MAX_PITCH_SETPOINT);
+        rc_saturate_double(&setpoint.roll, -MAX_ROLL_SETPOINT, MAX_ROLL_SETPOINT);
+    }
+}
+
+/**
+ * @brief      mix_input_t for the attitude controllers, marches the roll, pitch
+ *             or yaw controller with its output limited to [min,max].
+ */
+static double __march_attitude(int ch, double min, double max)
+{
+    rc_filter_t* D;
+    double gain_orig, err;
+
+    switch (ch)
+    {
+        case VEC_ROLL:
+            D = &D_roll;
+            gain_orig = D_roll_gain_orig;
+            err = att_err[0];
+            break;
+        case VEC_PITCH:
+            D = &D_pitch;
+            gain_orig = D_pitch_gain_orig;
+            err = att_err[1];
+            break;
+        case VEC_YAW:
+            D = &D_yaw;
+            gain_orig = D_yaw_gain_orig;
+            err = att_err[2];
+            break;
+        default:
+            return 0.0;
+    }
+
+    rc_filter_enable_saturation(D, min, max);
+    D->gain = gain_orig * state_estimate.v_batt_comp;
+    return rc_filter_march(D, err);
+}
+
 int feedback_march(void)
 {
     int i;
-    double tmp, min, max;
-    double u[6], mot[8];
-    log_entry_t new_log;
+    int64_t since_dmp;
+    double tmp, tilt_cos;
+    double u[6];
+#ifdef MIX_F32
+    float mot_f[8], sig_f[8];
+#else
+    double mot[8];
+#endif
+    mix_input_t input[6] = {NULL};
+    static const double u_max[6] = {MAX_X_COMPONENT, MAX_Y_COMPONENT, 0.0, MAX_ROLL_COMPONENT,
+        MAX_PITCH_COMPONENT, MAX_YAW_COMPONENT};
     static int last_en_Z_ctrl = 0;
 
     // Disarm if rc_state is somehow paused without disarming the controller.
@@ -190,12 +452,19 @@ int feedback_march(void)
         feedback_disarm();
     }
 
-    // check for a tipover
-    if (fabs(state_estimate.roll) > TIP_ANGLE || fabs(state_estimate.pitch) > TIP_ANGLE)
+    // check for a tipover, body Z more than TIP_ANGLE from vertical in any
+    // direction, cos(TIP_ANGLE) is folded by the compiler
+    tilt_cos = __tilt_cos();
+    if (tilt_cos < cos(TIP_ANGLE))
     {
+        if (fstate.arm_state == ARMED) blackbox_trigger(BLACKBOX_TIPOVER);
         feedback_disarm();
-        printf("\n TIPOVER DETECTED \n");
+        // report once per tipover rather than every loop spent on its side
+        if (!tipped) atomic_fetch_add_explicit(&tipover_events, 1, memory_order_relaxed);
+        tipped = 1;
     }
+    else
+        tipped = 0;
 
     // if not running or not armed, keep the motors in an idle state
     if (rc_get_state() != RUNNING || fstate.arm_state == DISARMED)
@@ -205,8 +474,7 @@ int feedback_march(void)
     }
 
     // We are about to start marching the individual SISO controllers forward.
-    // Start by zeroing out the motors signals then add from there.
-    for (i = 0; i < 8; i++) mot[i] = 0.0;
+    // Start by zeroing out the inputs then fill in from there.
     for (i = 0; i < 6; i++) u[i] = 0.0;
 
     /***************************************************************************
@@ -228,119 +496,83 @@ int feedback_march(void)
         {
             setpoint.Z = state_estimate.alt_bmp;  // set altitude setpoint to current altitude
             rc_filter_reset(&D_Z);
-            tmp = -setpoint.Z_throttle / (cos(state_estimate.roll) * cos(state_estimate.pitch));
+            tmp = -setpoint.Z_throttle / tilt_cos;
             rc_filter_prefill_outputs(&D_Z, tmp);
             last_en_Z_ctrl = 1;
         }
-        D_Z.gain = D_Z_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
+        D_Z.gain = D_Z_gain_orig * state_estimate.v_batt_comp;
         tmp = rc_filter_march(
             &D_Z, -setpoint.Z + state_estimate.alt_bmp);  // altitude is positive but +Z is down
         rc_saturate_double(&tmp, MIN_THRUST_COMPONENT, MAX_THRUST_COMPONENT);
-        u[VEC_Z] = tmp / cos(state_estimate.roll) * cos(state_estimate.pitch);
-        mix_add_input(u[VEC_Z], VEC_Z, mot);
+        u[VEC_Z] = tmp / tilt_cos;
         last_en_Z_ctrl = 1;
     }
     // else use direct throttle
     else
     {
         // compensate for tilt
-        tmp = setpoint.Z_throttle / (cos(state_estimate.roll) * cos(state_estimate.pitch));
+        tmp = setpoint.Z_throttle / tilt_cos;
         // printf("throttle: %f\n",tmp);
         rc_saturate_double(&tmp, MIN_THRUST_COMPONENT, MAX_THRUST_COMPONENT);
         u[VEC_Z] = tmp;
-        mix_add_input(u[VEC_Z], VEC_Z, mot);
     }
 
+    /***************************************************************************
+     * Horizontal velocity/position cascade, decimated outer loop which sets
+     * the roll and pitch or X and Y thrust setpoints used below
+     ***************************************************************************/
+    if (setpoint.en_XY_vel_ctrl || setpoint.en_XY_pos_ctrl)
+        __march_XY();
+    else
+        last_en_XY_ctrl = 0;
+
     /***************************************************************************
      * Roll Pitch Yaw controllers, only run if enabled
+     *
+     * Channels are mixed in priority order by mix_allocate, each one limited
+     * to what the motors can still take after the ones before it. Controllers
+     * are marched from inside mix_allocate so their saturation can be set to
+     * that range first.
      ***************************************************************************/
     if (setpoint.en_rpy_ctrl)
     {
-        // Roll
-        mix_check_saturation(VEC_ROLL, mot, &min, &max);
-        if (max > MAX_ROLL_COMPONENT) max = MAX_ROLL_COMPONENT;
-        if (min < -MAX_ROLL_COMPONENT) min = -MAX_ROLL_COMPONENT;
-        rc_filter_enable_saturation(&D_roll, min, max);
-        D_roll.gain = D_roll_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-        u[VEC_ROLL] = rc_filter_march(&D_roll, setpoint.roll - state_estimate.roll);
-        mix_add_input(u[VEC_ROLL], VEC_ROLL, mot);
-
-        // pitch
-        mix_check_saturation(VEC_PITCH, mot, &min, &max);
-        if (max > MAX_PITCH_COMPONENT) max = MAX_PITCH_COMPONENT;
-        if (min < -MAX_PITCH_COMPONENT) min = -MAX_PITCH_COMPONENT;
-        rc_filter_enable_saturation(&D_pitch, min, max);
-        D_pitch.gain = D_pitch_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-        u[VEC_PITCH] = rc_filter_march(&D_pitch, setpoint.pitch - state_estimate.pitch);
-        mix_add_input(u[VEC_PITCH], VEC_PITCH, mot);
-
-        // Yaw
-        // if throttle stick is down (waiting to take off) keep yaw setpoint at
-        // current heading, otherwide update by yaw rate
-        mix_check_saturation(VEC_YAW, mot, &min, &max);
-        if (max > MAX_YAW_COMPONENT) max = MAX_YAW_COMPONENT;
-        if (min < -MAX_YAW_COMPONENT) min = -MAX_YAW_COMPONENT;
-        rc_filter_enable_saturation(&D_yaw, min, max);
-        D_yaw.gain = D_yaw_gain_orig * settings.v_nominal / state_estimate.v_batt_lp;
-        u[VEC_YAW] = rc_filter_march(&D_yaw, setpoint.yaw - state_estimate.yaw);
-        mix_add_input(u[VEC_YAW], VEC_YAW, mot);
+        __attitude_error();
+        input[VEC_ROLL] = __march_attitude;
+        input[VEC_PITCH] = __march_attitude;
+        input[VEC_YAW] = __march_attitude;
     }
     // otherwise direct throttle to roll pitch yaw
     else
     {
-        // roll
-        mix_check_saturation(VEC_ROLL, mot, &min, &max);
-        if (max > MAX_ROLL_COMPONENT) max = MAX_ROLL_COMPONENT;
-        if (min < -MAX_ROLL_COMPONENT) min = -MAX_ROLL_COMPONENT;
         u[VEC_ROLL] = setpoint.roll_throttle;
-        rc_saturate_double(&u[VEC_ROLL], min, max);
-        mix_add_input(u[VEC_ROLL], VEC_ROLL, mot);
-
-        // pitch
-        mix_check_saturation(VEC_PITCH, mot, &min, &max);
-        if (max > MAX_PITCH_COMPONENT) max = MAX_PITCH_COMPONENT;
-        if (min < -MAX_PITCH_COMPONENT) min = -MAX_PITCH_COMPONENT;
         u[VEC_PITCH] = setpoint.pitch_throttle;
-        rc_saturate_double(&u[VEC_PITCH], min, max);
-        mix_add_input(u[VEC_PITCH], VEC_PITCH, mot);
-
-        // YAW
-        mix_check_saturation(VEC_YAW, mot, &min, &max);
-        if (max > MAX_YAW_COMPONENT) max = MAX_YAW_COMPONENT;
-        if (min < -MAX_YAW_COMPONENT) min = -MAX_YAW_COMPONENT;
         u[VEC_YAW] = setpoint.yaw_throttle;
-        rc_saturate_double(&u[VEC_YAW], min, max);
-        mix_add_input(u[VEC_YAW], VEC_YAW, mot);
     }
 
     // for 6dof systems, add X and Y
     if (setpoint.en_6dof)
     {
-        // X
-        mix_check_saturation(VEC_X, mot, &min, &max);
-        if (max > MAX_X_COMPONENT) max = MAX_X_COMPONENT;
-        if (min < -MAX_X_COMPONENT) min = -MAX_X_COMPONENT;
         u[VEC_X] = setpoint.X_throttle;
-        rc_saturate_double(&u[VEC_X], min, max);
-        mix_add_input(u[VEC_X], VEC_X, mot);
-
-        // Y
-        mix_check_saturation(VEC_Y, mot, &min, &max);
-        if (max > MAX_Y_COMPONENT) max = MAX_Y_COMPONENT;
-        if (min < -MAX_Y_COMPONENT) min = -MAX_Y_COMPONENT;
         u[VEC_Y] = setpoint.Y_throttle;
-        rc_saturate_double(&u[VEC_Y], min, max);
-        mix_add_input(u[VEC_Y], VEC_Y, mot);
     }
 
     /***************************************************************************
-     * Send ESC motor signals immediately at the end of the control loop
+     * Mix and send ESC motor signals immediately at the end of the control loop
      ***************************************************************************/
+#ifdef MIX_F32
+    // single precision output stage, NEON on the BeagleBone
+    mix_allocate_f32(u, u_max, input, mot_f);
+    map_motor_signals_f32(mot_f, sig_f, settings.num_rotors);
+    for (i = 0; i < settings.num_rotors; i++)
+    {
+        fstate.m[i] = sig_f[i];
+        rc_servo_send_esc_pulse_normalized(i + 1, fstate.m[i]);
+    }
+#else
+    mix_allocate(u, u_max, input, mot);
+    map_motor_signals(mot, fstate.m, settings.num_rotors);
     for (i = 0; i < settings.num_rotors; i++)
     {
-        rc_saturate_double(&mot[i], 0.0, 1.0);
-        fstate.m[i] = map_motor_signal(mot[i]);
-
         // NO NO NO this undoes all the fancy mixing-based saturation
         // done above, idle should be done with MAX_THRUST_COMPONENT instead
         // rc_saturate_double(&fstate.m[i], MOTOR_IDLE_CMD, 1.0);
@@ -352,6 +584,9 @@ int feedback_march(void)
         // finally send pulses!
         rc_servo_send_esc_pulse_normalized(i + 1, fstate.m[i]);
     }
+#endif
+    since_dmp = rc_mpu_nanos_since_last_dmp_interrupt();
+    if (since_dmp >= 0) timing_record(TIMING_SENSOR_TO_MOTOR, since_dmp);
 
     /***************************************************************************
      * Final cleanup, timing, and indexing
@@ -366,6 +601,21 @@ int feedback_march(void)
     return 0;
 }
 
+void feedback_print_events(FILE* fp)
+{
+    unsigned int n;
+
+    n = atomic_load_explicit(&tipover_events, memory_order_relaxed);
+    if (n != printed_tipovers) fprintf(fp, "\n TIPOVER DETECTED \n");
+    printed_tipovers = n;
+    n = atomic_load_explicit(&rearm_events, memory_order_relaxed);
+    if (n != printed_rearms)
+    {
+        fprintf(fp, "WARNING: trying to arm when controller is already armed\n");
+    }
+    printed_rearms = n;
+}
+
 int feedback_cleanup(void)
 {
     __send_motor_stop_pulse();
@@ -4,7 +4,9 @@
 
 #include <errno.h>
 #include <math.h>  // for fabs
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <rc/dsm.h>
@@ -15,15 +17,33 @@
 
 #include <input_manager.h>
 #include <rc_pilot_defs.h>
+#include <rt_harden.h>
+#include <seqlock.h>
 #include <settings.h>
-#include <state_estimator.h>
+#include <snapshot.h>
 #include <thread_defs.h>
 
-user_input_t user_input;  // extern variable in input_manager.h
+#define READ_TRIES 2  // torn copies to put up with before giving up
+
+// Working copy, written by the DSM callbacks and the input manager thread with
+// input_lock held and published to readers by __publish
+static user_input_t user_input;
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static user_input_t latest;
+static seqlock_t latest_lock = SEQLOCK_INITIALIZER;
 
 static pthread_t input_manager_thread;
 static arm_state_t kill_switch = DISARMED;  // raw kill switch on the radio
 
+/**
+ * @brief      Publish the working copy, input_lock must be held
+ */
+static void __publish(void)
+{
+    seqlock_write(&latest_lock, &latest, &user_input, sizeof(user_input));
+}
+
 /**
  * float apply_deadzone(float in, float zone)
  *
@@ -48,22 +68,26 @@ static double __deadzone(double in, double zone)
  */
 static int __wait_for_arming_sequence()
 {
+    user_input_t input;
+    snapshot_t snap;
+
     // already armed, just return. Should never do this in normal operation though
-    if (user_input.requested_arm_mode == ARMED) return 0;
+    if (input_manager_get_latest(&input) == 0 && input.requested_arm_mode == ARMED) return 0;
 
 ARM_SEQUENCE_START:
-    // wait for feedback controller to have started
-    while (fstate.initialized == 0)
+    // wait for feedback controller to have started, the first snapshot is only
+    // published once the IMU interrupt is running
+    while (snapshot_get(&snap) || snap.fstate.initialized == 0)
     {
         rc_usleep(100000);
         if (rc_get_state() == EXITING) return 0;
     }
     // wait for level
-    while (fabs(state_estimate.roll) > ARM_TIP_THRESHOLD ||
-           fabs(state_estimate.pitch) > ARM_TIP_THRESHOLD)
+    while (fabs(snap.state.roll) > ARM_TIP_THRESHOLD || fabs(snap.state.pitch) > ARM_TIP_THRESHOLD)
     {
         rc_usleep(100000);
         if (rc_get_state() == EXITING) return 0;
+        snapshot_get(&snap);
     }
     // wait for kill switch to be switched to ARMED
     while (kill_switch == DISARMED)
@@ -88,8 +112,8 @@ ARM_SEQUENCE_START:
 
     // final check of kill switch and level before arming
     if (kill_switch == DISARMED) goto ARM_SEQUENCE_START;
-    if (fabs(state_estimate.roll) > ARM_TIP_THRESHOLD ||
-        fabs(state_estimate.pitch) > ARM_TIP_THRESHOLD)
+    if (snapshot_get(&snap) || fabs(snap.state.roll) > ARM_TIP_THRESHOLD ||
+        fabs(snap.state.pitch) > ARM_TIP_THRESHOLD)
     {
         goto ARM_SEQUENCE_START;
     }
@@ -109,6 +133,8 @@ void new_dsm_data_callback()
         __deadzone(rc_dsm_ch_normalized(settings.dsm_yaw_ch) * settings.dsm_yaw_pol, YAW_DEADZONE);
     new_mode = rc_dsm_ch_normalized(settings.dsm_mode_ch) * settings.dsm_mode_pol;
 
+    pthread_mutex_lock(&input_lock);
+
     // kill mode behaviors
     switch (settings.dsm_kill_mode)
     {
@@ -138,6 +164,7 @@ void new_dsm_data_callback()
 
         default:
             fprintf(stderr, "ERROR in input manager, unhandled settings.dsm_kill_mode\n");
+            pthread_mutex_unlock(&input_lock);
             return;
     }
 
@@ -202,11 +229,14 @@ void new_dsm_data_callback()
         user_input.input_active = 1;  // flag that connection has come back online
         printf("DSM CONNECTION ESTABLISHED\n");
     }
+    __publish();
+    pthread_mutex_unlock(&input_lock);
     return;
 }
 
 void dsm_disconnect_callback(void)
 {
+    pthread_mutex_lock(&input_lock);
     user_input.thr_stick = 0.0;
     user_input.roll_stick = 0.0;
     user_input.pitch_stick = 0.0;
@@ -214,16 +244,26 @@ void dsm_disconnect_callback(void)
     user_input.input_active = 0;
     kill_switch = DISARMED;
     user_input.requested_arm_mode = DISARMED;
+    __publish();
+    pthread_mutex_unlock(&input_lock);
     fprintf(stderr, "LOST DSM CONNECTION\n");
 }
 
 void* input_manager(void* ptr)
 {
+    user_input_t input;
+
+    rt_prefault_stack();
+    memset(&input, 0, sizeof(input));
+    pthread_mutex_lock(&input_lock);
     user_input.initialized = 1;
+    __publish();
+    pthread_mutex_unlock(&input_lock);
     // wait for first packet
     while (rc_get_state() != EXITING)
     {
-        if (user_input.input_active) break;
+        input_manager_get_latest(&input);
+        if (input.input_active) break;
         rc_usleep(1000000 / INPUT_MANAGER_HZ);
     }
 
@@ -232,7 +272,8 @@ void* input_manager(void* ptr)
     while (rc_get_state() != EXITING)
     {
         // if the core got disarmed, wait for arming sequence
-        if (user_input.requested_arm_mode == DISARMED)
+        input_manager_get_latest(&input);
+        if (input.requested_arm_mode == DISARMED)
         {
             __wait_for_arming_sequence();
             // user may have pressed the pause button or shut down while waiting
@@ -241,7 +282,10 @@ void* input_manager(void* ptr)
                 continue;
             else
             {
+                pthread_mutex_lock(&input_lock);
                 user_input.requested_arm_mode = ARMED;
+                __publish();
+                pthread_mutex_unlock(&input_lock);
                 // printf("\n\nDSM ARM REQUEST\n\n");
             }
         }
@@ -253,8 +297,13 @@ void* input_manager(void* ptr)
 
 int input_manager_init()
 {
-    user_input.initialized = 0;
     int i;
+    user_input_t input;
+
+    pthread_mutex_lock(&input_lock);
+    user_input.initialized = 0;
+    __publish();
+    pthread_mutex_unlock(&input_lock);
     // start dsm hardware
     if (rc_dsm_init() == -1)
     {
@@ -273,16 +322,27 @@ int input_manager_init()
     // wait for thread to start
     for (i = 0; i < 50; i++)
     {
-        if (user_input.initialized) return 0;
+        if (input_manager_get_latest(&input) == 0 && input.initialized) return 0;
         rc_usleep(50000);
     }
     fprintf(stderr, "ERROR in input_manager_init, timeout waiting for thread to start\n");
     return -1;
 }
 
+int input_manager_get_latest(user_input_t* u)
+{
+    user_input_t tmp;
+
+    if (seqlock_read(&latest_lock, &tmp, &latest, sizeof(tmp), READ_TRIES)) return -1;
+    *u = tmp;
+    return 0;
+}
+
 int input_manager_cleanup()
 {
-    if (user_input.initialized == 0)
+    user_input_t input;
+
+    if (input_manager_get_latest(&input) || input.initialized == 0)
     {
         fprintf(stderr, "WARNING in input_manager_cleanup, was never initialized\n");
         return -1;
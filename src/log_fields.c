@@ -0,0 +1,159 @@
+/**
+ * @file log_fields.c
+ */
+
+#include <string.h>
+
+#include <deadline.h>
+#include <feedback.h>
+#include <log_fields.h>
+#include <rc_pilot_defs.h>
+#include <setpoint_manager.h>
+#include <settings.h>
+#include <state_estimator.h>
+
+/**
+ * One column that can be captured into a log. Every entry copies 8 bytes
+ * from src, so src must point at a uint64_t or double that stays valid for the
+ * life of the program. To log something new add a line to log_sources[].
+ */
+typedef struct log_source_t
+{
+    const char* name;   ///< column name in the csv, under LOG_FIELD_NAME_LEN
+    log_type_t type;    ///< how the 8 bytes are interpreted
+    log_group_t group;  ///< settings group that enables this field
+    const char* unit;   ///< stored in the file header, under LOG_FIELD_UNIT_LEN
+    const void* src;    ///< value captured every entry
+    int rotor;          ///< motor number for motor signals, 0 otherwise
+} log_source_t;
+
+// shorthand for the motor signal lines, only enabled up to num_rotors
+#define LOG_MOTOR(n) {"mot_" #n, LOG_TYPE_F64, LOG_GROUP_MOTOR_SIGNALS, "", &fstate.m[n - 1], n}
+
+/**
+ * Every field that can be logged in the order they appear in the file.
+ */
+static const log_source_t log_sources[] = {
+    // index, always logged
+    {"loop_index", LOG_TYPE_U64, LOG_GROUP_INDEX, "", &fstate.loop_index, 0},
+    {"last_step_ns", LOG_TYPE_U64, LOG_GROUP_INDEX, "ns", &fstate.last_step_ns, 0},
+    {"overruns", LOG_TYPE_U64, LOG_GROUP_INDEX, "", &deadline.overruns, 0},
+    {"degrade_level", LOG_TYPE_U64, LOG_GROUP_INDEX, "", &deadline.level, 0},
+    // sensors
+    {"v_batt", LOG_TYPE_F64, LOG_GROUP_SENSORS, "V", &state_estimate.v_batt_lp, 0},
+    {"alt_bmp_raw", LOG_TYPE_F64, LOG_GROUP_SENSORS, "m", &state_estimate.alt_bmp_raw, 0},
+    {"gyro_roll", LOG_TYPE_F64, LOG_GROUP_SENSORS, "rad/s", &state_estimate.gyro[0], 0},
+    {"gyro_pitch", LOG_TYPE_F64, LOG_GROUP_SENSORS, "rad/s", &state_estimate.gyro[1], 0},
+    {"gyro_yaw", LOG_TYPE_F64, LOG_GROUP_SENSORS, "rad/s", &state_estimate.gyro[2], 0},
+    {"accel_X", LOG_TYPE_F64, LOG_GROUP_SENSORS, "m/s^2", &state_estimate.accel[0], 0},
+    {"accel_Y", LOG_TYPE_F64, LOG_GROUP_SENSORS, "m/s^2", &state_estimate.accel[1], 0},
+    {"accel_Z", LOG_TYPE_F64, LOG_GROUP_SENSORS, "m/s^2", &state_estimate.accel[2], 0},
+    // state estimate
+    {"roll", LOG_TYPE_F64, LOG_GROUP_STATE, "rad", &state_estimate.tb_imu[0], 0},
+    {"pitch", LOG_TYPE_F64, LOG_GROUP_STATE, "rad", &state_estimate.tb_imu[1], 0},
+    {"yaw", LOG_TYPE_F64, LOG_GROUP_STATE, "rad", &state_estimate.tb_imu[2], 0},
+    {"qw", LOG_TYPE_F64, LOG_GROUP_STATE, "", &state_estimate.quat[0], 0},
+    {"qx", LOG_TYPE_F64, LOG_GROUP_STATE, "", &state_estimate.quat[1], 0},
+    {"qy", LOG_TYPE_F64, LOG_GROUP_STATE, "", &state_estimate.quat[2], 0},
+    {"qz", LOG_TYPE_F64, LOG_GROUP_STATE, "", &state_estimate.quat[3], 0},
+    {"X", LOG_TYPE_F64, LOG_GROUP_STATE, "m", &state_estimate.pos_global[0], 0},
+    {"Y", LOG_TYPE_F64, LOG_GROUP_STATE, "m", &state_estimate.pos_global[1], 0},
+    {"Z", LOG_TYPE_F64, LOG_GROUP_STATE, "m", &state_estimate.pos_global[2], 0},
+    {"Xdot", LOG_TYPE_F64, LOG_GROUP_STATE, "m/s", &state_estimate.vel_global[0], 0},
+    {"Ydot", LOG_TYPE_F64, LOG_GROUP_STATE, "m/s", &state_estimate.vel_global[1], 0},
+    {"Zdot", LOG_TYPE_F64, LOG_GROUP_STATE, "m/s", &state_estimate.vel_global[2], 0},
+    // setpoint
+    {"sp_roll", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "rad", &setpoint.roll, 0},
+    {"sp_pitch", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "rad", &setpoint.pitch, 0},
+    {"sp_yaw", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "rad", &setpoint.yaw, 0},
+    {"sp_X", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m", &setpoint.X, 0},
+    {"sp_Y", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m", &setpoint.Y, 0},
+    {"sp_Z", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m", &setpoint.Z, 0},
+    {"sp_Xdot", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m/s", &setpoint.X_dot, 0},
+    {"sp_Ydot", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m/s", &setpoint.Y_dot, 0},
+    {"sp_Zdot", LOG_TYPE_F64, LOG_GROUP_SETPOINT, "m/s", &setpoint.Z_dot, 0},
+    // orthogonal control outputs
+    {"u_roll", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_ROLL], 0},
+    {"u_pitch", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_PITCH], 0},
+    {"u_yaw", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_YAW], 0},
+    {"u_X", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_X], 0},
+    {"u_Y", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_Y], 0},
+    {"u_Z", LOG_TYPE_F64, LOG_GROUP_CONTROL_U, "", &fstate.u[VEC_Z], 0},
+    // motor signals
+    LOG_MOTOR(1), LOG_MOTOR(2), LOG_MOTOR(3), LOG_MOTOR(4),
+    LOG_MOTOR(5), LOG_MOTOR(6), LOG_MOTOR(7), LOG_MOTOR(8),
+};
+
+#define NUM_LOG_SOURCES (int)(sizeof(log_sources) / sizeof(log_sources[0]))
+
+uint32_t log_fields_groups_from_settings(void)
+{
+    uint32_t groups = 1 << LOG_GROUP_INDEX;
+
+    if (settings.log_sensors) groups |= 1 << LOG_GROUP_SENSORS;
+    if (settings.log_state) groups |= 1 << LOG_GROUP_STATE;
+    if (settings.log_setpoint) groups |= 1 << LOG_GROUP_SETPOINT;
+    if (settings.log_control_u) groups |= 1 << LOG_GROUP_CONTROL_U;
+    if (settings.log_motor_signals) groups |= 1 << LOG_GROUP_MOTOR_SIGNALS;
+    return groups;
+}
+
+int log_fields_init(log_fields_t* f, uint32_t groups)
+{
+    int i;
+    const log_source_t* s;
+    log_field_desc_t* d;
+
+    f->num = 0;
+    f->groups = 0;
+    f->record_len = 1;  // record type byte
+
+    for (i = 0; i < NUM_LOG_SOURCES && f->num < LOG_MAX_FIELDS; i++)
+    {
+        s = &log_sources[i];
+        if (!(groups & (1 << s->group))) continue;
+        if (s->rotor > settings.num_rotors) continue;
+
+        d = &f->desc[f->num];
+        memset(d, 0, sizeof(log_field_desc_t));
+        strncpy(d->name, s->name, LOG_FIELD_NAME_LEN - 1);
+        strncpy(d->unit, s->unit, LOG_FIELD_UNIT_LEN - 1);
+        d->type = s->type;
+        d->group = s->group;
+        f->src[f->num] = s->src;
+        f->groups |= 1 << s->group;
+        f->record_len += sizeof(uint64_t);
+        f->num++;
+    }
+    return f->num;
+}
+
+void log_fields_capture(const log_fields_t* f, uint64_t* dst)
+{
+    int i;
+    for (i = 0; i < f->num; i++)
+    {
+        memcpy(&dst[i], f->src[i], sizeof(uint64_t));
+    }
+}
+
+int log_fields_header_len(const log_fields_t* f)
+{
+    return sizeof(log_file_header_t) + f->num * sizeof(log_field_desc_t);
+}
+
+int log_fields_write_header(const log_fields_t* f, char* dst)
+{
+    log_file_header_t h;
+
+    memcpy(h.magic, LOG_FILE_MAGIC, sizeof(h.magic));
+    h.version = LOG_FORMAT_VERSION;
+    h.num_fields = f->num;
+    h.groups = f->groups;
+    h.num_rotors = settings.num_rotors;
+    h.record_len = f->record_len;
+
+    memcpy(dst, &h, sizeof(h));
+    memcpy(dst + sizeof(h), f->desc, f->num * sizeof(log_field_desc_t));
+    return log_fields_header_len(f);
+}
@@ -2,10 +2,16 @@
  * @file log_manager.c
  */
 
+#define _GNU_SOURCE  // for fallocate
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -18,171 +24,770 @@
 #include <rc/start_stop.h>
 #include <rc/time.h>
 
+#include <deadline.h>
 #include <feedback.h>
+#include <log_fields.h>
+#include <log_format.h>
 #include <log_manager.h>
 #include <rc_pilot_defs.h>
+#include <rt_harden.h>
 #include <setpoint_manager.h>
 #include <settings.h>
+#include <snapshot.h>
 #include <state_estimator.h>
 #include <thread_defs.h>
+#include <timing.h>
 
-#define MAX_LOG_FILES 500
-#define BUF_LEN 50
+#define LOG_INDEX_FILE LOG_DIR "next_index"  // persisted number of the next log file
+#define WRITE_CHUNK 50     // max entries copied into the file between syncs
+#define WAKE_THRESHOLD 50  // entries waiting before the writer thread is woken
 
-static uint64_t num_entries;  // number of entries logged so far
-static int buffer_pos;        // position in current buffer
-static int current_buf;       // 0 or 1 to indicate which buffer is being filled
-static int needs_writing;     // flag set to 1 if a buffer is full
-static FILE* fd;              // file descriptor for the log file
+/**
+ * An open log file along with its number in the LOG_DIR series. Files are
+ * preallocated on disk one segment at a time and written through a shared
+ * memory mapping. len is the amount of valid data, the rest of the mapping is
+ * zeros until the file is truncated on close.
+ */
+typedef struct log_file_t
+{
+    int fd;         ///< file descriptor, -1 if not open
+    int index;      ///< number in the series, file name is LOG_DIR/index.bin
+    char* map;      ///< start of the shared mapping
+    size_t size;    ///< bytes allocated on disk and mapped
+    size_t len;     ///< bytes of valid data written so far
+    size_t synced;  ///< bytes already handed to msync
+    int keyframe_countdown;  ///< entries until the next keyframe, 0 forces one
+} log_file_t;
+
+// file currently being written, and the next one which is opened ahead of
+// time by the writer thread so that arming doesn't have to wait on the disk
+static log_file_t cur_file = {.fd = -1};
+static log_file_t next_file = {.fd = -1};
+static size_t segment_bytes;  // preallocation size, set from settings at init
+static size_t page_size;
+static int next_index;  // number the next log file will get, see __load_next_index()
 
-// array of two buffers so one can fill while writing the other to file
-static log_entry_t buffer[2][BUF_LEN];
+/**
+ * slot in the ring buffer, new_segment marks the first entry after arming
+ * which should go to a fresh log file. Slots are slot_len bytes apart with
+ * room for one value per enabled field.
+ */
+typedef struct log_slot_t
+{
+    uint32_t new_segment;
+    uint32_t reserved;  // keeps value 8-byte aligned
+    uint64_t value[];   // raw bits of each field in file order
+} log_slot_t;
+
+/*
+ * Single producer single consumer ring buffer between the IMU interrupt
+ * (producer, log_manager_add_new) and the writer thread (consumer). head and
+ * tail are free-running counters, only the producer writes head and only the
+ * consumer writes tail. The release store of head publishes the entry it
+ * covers, the release store of tail hands the slot back to the producer.
+ * ring_len is always a power of two so counters can wrap freely.
+ */
+static char* ring;
+static size_t slot_len;
+static uint32_t ring_len;
+static uint32_t ring_mask;
+static atomic_uint ring_head;
+static atomic_uint ring_tail;
+
+// statistics for the trailer, only written by the producer
+static atomic_uint num_entries;  // number of entries logged so far
+static atomic_uint num_dropped;  // entries lost because the ring was full
+static atomic_uint high_water;   // most entries ever waiting in the ring
+
+// writer sleeps on this until WAKE_THRESHOLD entries are waiting
+static sem_t wake_sem;
+
+// set by log_manager_new_segment, consumed by the next log_manager_add_new
+static atomic_int segment_pending;
+
+// per-segment bookkeeping, only touched by the writer thread
+static uint64_t seg_entries;
+static uint32_t seg_dropped_base;
+
+// column layout of the log files and where each value is copied from,
+// filled in by __setup_fields()
+static log_fields_t layout;
+static int compressed;      // any field has a resolution, write keyframes/deltas
+static int max_record_len;  // worst case for whichever record type is in use
+
+// last value written for each field as a raw integer or quantized double,
+// only touched by the writer thread
+static uint64_t prev_value[LOG_MAX_FIELDS];
 
 // background thread and running flag
 static pthread_t pthread;
-static int logging_enabled;  // set to 0 to exit the write_thread
+static atomic_int logging_enabled;  // set to 0 to exit the write_thread
+
+/**
+ * @brief      Quantization step for doubles in a group from the settings, 0
+ *             means the group is stored at full precision.
+ */
+static double __group_resolution(log_group_t group)
+{
+    switch (group)
+    {
+        case LOG_GROUP_SENSORS:
+            return settings.log_resolution_sensors;
+        case LOG_GROUP_STATE:
+            return settings.log_resolution_state;
+        case LOG_GROUP_SETPOINT:
+            return settings.log_resolution_setpoint;
+        case LOG_GROUP_CONTROL_U:
+            return settings.log_resolution_control_u;
+        case LOG_GROUP_MOTOR_SIGNALS:
+            return settings.log_resolution_motor_signals;
+        default:
+            return 0.0;
+    }
+}
 
-static int __write_header(FILE* fd)
+/**
+ * @brief      Pick the columns enabled in the settings and apply the
+ *             compression resolution of each group.
+ */
+static void __setup_fields(void)
 {
-    // always print loop index
-    fprintf(fd, "loop_index,last_step_ns");
+    int i;
 
-    if (settings.log_sensors)
+    log_fields_init(&layout, log_fields_groups_from_settings());
+
+    compressed = 0;
+    for (i = 0; i < layout.num; i++)
     {
-        fprintf(fd, ",v_batt,alt_bmp_raw,gyro_roll,gyro_pitch,gyro_yaw,accel_X,accel_Y,accel_Z");
+        if (layout.desc[i].type != LOG_TYPE_F64) continue;
+        layout.desc[i].resolution = __group_resolution(layout.desc[i].group);
+        if (layout.desc[i].resolution > 0.0) compressed = 1;
     }
 
-    if (settings.log_state)
+    // type byte, payload length, and a full length varint for every field
+    if (compressed)
+        max_record_len = 1 + sizeof(uint16_t) + layout.num * LOG_VARINT_MAX_LEN;
+    else
+        max_record_len = layout.record_len;
+}
+
+static inline log_slot_t* __slot(uint32_t i)
+{
+    return (log_slot_t*)(ring + (size_t)(i & ring_mask) * slot_len);
+}
+
+/**
+ * @brief      Pack one captured entry into dst as an entry record. Values are
+ *             already in file order so this is a single copy.
+ *
+ * @return     number of bytes written to dst
+ */
+static int __pack_entry(char* dst, const log_slot_t* slot)
+{
+    dst[0] = (char)LOG_RECORD_ENTRY;
+    memcpy(dst + 1, slot->value, layout.num * sizeof(uint64_t));
+    return layout.record_len;
+}
+
+/**
+ * @brief      Compress a captured entry into a keyframe or delta record
+ *             against the previous entry written.
+ *
+ * @param      dst       destination, at least max_record_len bytes
+ * @param      slot      captured entry
+ * @param[in]  keyframe  1 to write absolute values instead of deltas
+ *
+ * @return     number of bytes written to dst
+ */
+static int __compress_entry(uint8_t* dst, const log_slot_t* slot, int keyframe)
+{
+    int i;
+    uint8_t* p = dst + 1 + sizeof(uint16_t);
+    uint16_t payload_len;
+    uint64_t v;
+    double d;
+
+    for (i = 0; i < layout.num; i++)
     {
-        fprintf(fd, ",roll,pitch,yaw,X,Y,Z,Xdot,Ydot,Zdot");
+        v = slot->value[i];
+        if (layout.desc[i].type == LOG_TYPE_F64)
+        {
+            if (layout.desc[i].resolution == 0.0)
+            {
+                memcpy(p, &v, sizeof(v));
+                p += sizeof(v);
+                continue;
+            }
+            memcpy(&d, &v, sizeof(d));
+            v = (uint64_t)log_quantize(d, layout.desc[i].resolution);
+        }
+
+        // unsigned subtraction wraps so any pair of values has a valid delta
+        if (keyframe)
+            p += log_put_varint(p, v);
+        else
+            p += log_put_varint(p, log_zigzag((int64_t)(v - prev_value[i])));
+        prev_value[i] = v;
     }
 
-    if (settings.log_setpoint)
+    dst[0] = keyframe ? LOG_RECORD_KEYFRAME : LOG_RECORD_DELTA;
+    payload_len = p - dst - 1 - sizeof(uint16_t);
+    memcpy(dst + 1, &payload_len, sizeof(payload_len));
+    return p - dst;
+}
+
+/**
+ * @brief      Map bytes [0,size) of an open file after making sure the blocks
+ *             are allocated on disk, replacing any previous mapping.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __map_log_file(log_file_t* f, size_t size)
+{
+    char* map;
+
+    // allocate blocks now so the filesystem doesn't have to during flight,
+    // fall back to a sparse file if the filesystem can't preallocate
+    if (fallocate(f->fd, 0, f->size, size - f->size) == -1)
     {
-        fprintf(fd, ",sp_roll,sp_pitch,sp_yaw,sp_X,sp_Y,sp_Z,sp_Xdot,sp_Ydot,sp_Zdot");
+        if (ftruncate(f->fd, size) == -1)
+        {
+            fprintf(stderr, "ERROR in log_manager, failed to grow log file\n");
+            return -1;
+        }
     }
 
-    if (settings.log_control_u)
+    if (f->map != NULL) munmap(f->map, f->size);
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (map == MAP_FAILED)
     {
-        fprintf(fd, ",u_roll,u_pitch,u_yaw,u_X,u_Y,u_Z");
+        fprintf(stderr, "ERROR in log_manager, failed to mmap log file\n");
+        f->map = NULL;
+        return -1;
     }
+    // with enable_rt_hardening every page this thread writes would stay locked
+    // for the whole flight. Only this thread touches it, so unlock it.
+    munlock(map, size);
+    madvise(map, size, MADV_SEQUENTIAL);
+    f->map = map;
+    f->size = size;
+    return 0;
+}
 
-    if (settings.log_motor_signals && settings.num_rotors == 8)
+/**
+ * @brief      Make sure there is room for n more bytes in the mapping, adding
+ *             another segment to the file if not.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __reserve(log_file_t* f, size_t n)
+{
+    size_t size;
+
+    if (f->map == NULL) return -1;
+    if (f->len + n <= f->size) return 0;
+    size = f->size + segment_bytes;
+    while (size < f->len + n) size += segment_bytes;
+    return __map_log_file(f, size);
+}
+
+/**
+ * @brief      Start writeback of everything written since the last sync and
+ *             drop fully written pages from our address space.
+ *
+ *             msync with MS_ASYNC only schedules the writeback so this never
+ *             waits on the SD card.
+ */
+static void __sync_log_file(log_file_t* f)
+{
+    size_t start = f->synced & ~(page_size - 1);
+    size_t end = f->len & ~(page_size - 1);
+
+    if (f->map == NULL || f->len == f->synced) return;
+    msync(f->map + start, f->len - start, MS_ASYNC);
+    if (end > start) madvise(f->map + start, end - start, MADV_DONTNEED);
+    f->synced = f->len;
+}
+
+/**
+ * @brief      Pack n entries straight into the file mapping
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __write_entries(log_file_t* f, uint32_t first, int n)
+{
+    int i;
+
+    if (__reserve(f, n * max_record_len) == -1)
     {
-        fprintf(fd, ",mot_1,mot_2,mot_3,mot_4,mot_5,mot_6,mot_7,mot_8");
+        fprintf(stderr, "ERROR in log_manager, failed to write to log file\n");
+        return -1;
     }
-    if (settings.log_motor_signals && settings.num_rotors == 6)
+    for (i = 0; i < n; i++)
     {
-        fprintf(fd, ",mot_1,mot_2,mot_3,mot_4,mot_5,mot_6");
+        if (!compressed)
+        {
+            f->len += __pack_entry(f->map + f->len, __slot(first + i));
+            continue;
+        }
+        f->len += __compress_entry((uint8_t*)f->map + f->len, __slot(first + i),
+            f->keyframe_countdown == 0);
+        if (f->keyframe_countdown == 0) f->keyframe_countdown = settings.log_keyframe_interval;
+        f->keyframe_countdown--;
     }
-    if (settings.log_motor_signals && settings.num_rotors == 4)
+    return 0;
+}
+
+/**
+ * @brief      Find the highest numbered log file by listing LOG_DIR once. Only
+ *             used when the index file is missing or unreadable.
+ *
+ * @return     highest index found, 0 if there are no log files
+ */
+static int __scan_max_index(void)
+{
+    DIR* dir;
+    struct dirent* ent;
+    int index, max = 0;
+    char ext[sizeof(LOG_FILE_EXT) + 1];
+
+    dir = opendir(LOG_DIR);
+    if (dir == NULL) return 0;
+    while ((ent = readdir(dir)) != NULL)
     {
-        fprintf(fd, ",mot_1,mot_2,mot_3,mot_4");
+        if (sscanf(ent->d_name, "%d%5s", &index, ext) != 2) continue;
+        if (strcmp(ext, LOG_FILE_EXT) == 0 && index > max) max = index;
     }
+    closedir(dir);
+    return max;
+}
 
-    fprintf(fd, "\n");
-    return 0;
+/**
+ * @brief      Read the next log number from LOG_INDEX_FILE so picking a file
+ *             name doesn't depend on how many logs are already on the card.
+ */
+static void __load_next_index(void)
+{
+    FILE* fp;
+
+    next_index = 0;
+    fp = fopen(LOG_INDEX_FILE, "r");
+    if (fp != NULL)
+    {
+        if (fscanf(fp, "%d", &next_index) != 1) next_index = 0;
+        fclose(fp);
+    }
+    if (next_index < 1) next_index = __scan_max_index() + 1;
 }
 
-static int __write_log_entry(FILE* fd, log_entry_t e)
+/**
+ * @brief      Persist next_index, written to a temporary file and renamed so
+ *             a power loss leaves either the old or new value.
+ */
+static void __save_next_index(void)
 {
-    // always print loop index
-    fprintf(fd, "%" PRIu64 ",%" PRIu64, e.loop_index, e.last_step_ns);
+    FILE* fp;
+
+    fp = fopen(LOG_INDEX_FILE ".tmp", "w");
+    if (fp == NULL) return;
+    fprintf(fp, "%d\n", next_index);
+    fclose(fp);
+    rename(LOG_INDEX_FILE ".tmp", LOG_INDEX_FILE);
+}
 
-    if (settings.log_sensors)
+/**
+ * @brief      Create the next log file in the series, preallocate and map the
+ *             first segment, and write its header.
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __open_log_file(log_file_t* f)
+{
+    char path[100];
+    int index;
+
+    // O_EXCL only fails if the index file fell behind the logs on disk, skip
+    // past those files rather than overwrite them
+    for (index = next_index;; index++)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.v_batt, e.alt_bmp_raw,
-            e.gyro_roll, e.gyro_pitch, e.gyro_yaw, e.accel_X, e.accel_Y, e.accel_Z);
+        sprintf(path, LOG_DIR "%d" LOG_FILE_EXT, index);
+        // create and open new file for writing, mmap needs read access too
+        f->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (f->fd != -1 || errno != EEXIST) break;
+    }
+    if (f->fd == -1)
+    {
+        fprintf(stderr, "ERROR: can't open log file for writing\n");
+        return -1;
     }
+    next_index = index + 1;
+    __save_next_index();
 
-    if (settings.log_state)
+    f->index = index;
+    f->map = NULL;
+    f->size = 0;
+    f->synced = 0;
+    f->keyframe_countdown = 0;
+
+    if (__map_log_file(f, segment_bytes) == -1)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.roll, e.pitch, e.yaw, e.X,
-            e.Y, e.Z, e.Xdot, e.Ydot, e.Zdot);
+        close(f->fd);
+        unlink(path);
+        f->fd = -1;
+        return -1;
     }
 
-    if (settings.log_setpoint)
+    // write header
+    f->len = log_fields_write_header(&layout, f->map);
+    return 0;
+}
+
+/**
+ * @brief      Append the IMU interrupt timing statistics as a timing record
+ */
+static void __write_timing(log_file_t* f)
+{
+    int i;
+    uint16_t payload_len = TIMING_NUM_STAGES * sizeof(log_timing_stat_t);
+    log_timing_stat_t stat;
+    timing_stats_t s;
+    char* p;
+
+    if (__reserve(f, 1 + sizeof(payload_len) + payload_len) == -1) return;
+
+    p = f->map + f->len;
+    *p++ = (char)LOG_RECORD_TIMING;
+    memcpy(p, &payload_len, sizeof(payload_len));
+    p += sizeof(payload_len);
+    for (i = 0; i < TIMING_NUM_STAGES; i++)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.sp_roll, e.sp_pitch,
-            e.sp_yaw, e.sp_X, e.sp_Y, e.sp_Z, e.sp_Xdot, e.sp_Ydot, e.sp_Zdot);
+        timing_get_stats(i, &s);
+        memset(&stat, 0, sizeof(stat));
+        strncpy(stat.name, timing_stage_name(i), LOG_TIMING_NAME_LEN - 1);
+        stat.count = s.count;
+        stat.min_ns = s.min_ns;
+        stat.p50_ns = s.p50_ns;
+        stat.p99_ns = s.p99_ns;
+        stat.p999_ns = s.p999_ns;
+        stat.max_ns = s.max_ns;
+        stat.overruns = deadline_stage_overruns(i);
+        memcpy(p, &stat, sizeof(stat));
+        p += sizeof(stat);
     }
+    f->len = p - f->map;
+}
+
+static void __write_trailer(log_file_t* f)
+{
+    log_trailer_t t;
+    snapshot_t snap;
 
-    if (settings.log_control_u)
+    if (__reserve(f, 1 + sizeof(t)) == -1) return;
+
+    memset(&t, 0, sizeof(t));
+    t.num_entries = seg_entries;
+    t.num_dropped = atomic_load(&num_dropped) - seg_dropped_base;
+    t.high_water = atomic_load(&high_water);
+    t.buffer_len = ring_len;
+    if (snapshot_get(&snap) == 0) t.arm_duration_ns = snap.fstate.arm_duration_ns;
+
+    f->map[f->len] = (char)LOG_RECORD_TRAILER;
+    memcpy(f->map + f->len + 1, &t, sizeof(t));
+    f->len += 1 + sizeof(t);
+}
+
+/**
+ * @brief      Write the trailer, unmap, and cut the preallocated file down to
+ *             the data that was actually written.
+ */
+static void __close_log_file(log_file_t* f)
+{
+    if (f->fd == -1) return;
+    if (f->map != NULL)
+    {
+        __write_timing(f);
+        __write_trailer(f);
+        msync(f->map, f->len, MS_SYNC);
+        munmap(f->map, f->size);
+        f->map = NULL;
+    }
+    if (ftruncate(f->fd, f->len) == -1)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.u_roll, e.u_pitch, e.u_yaw,
-            e.u_X, e.u_Y, e.u_Z);
+        fprintf(stderr, "WARNING: failed to truncate log file %d\n", f->index);
     }
+    close(f->fd);
+    f->fd = -1;
+}
 
-    if (settings.log_motor_signals && settings.num_rotors == 8)
+/**
+ * @brief      Find the end of the valid data in a log file that was not closed
+ *             cleanly and truncate it there.
+ *
+ *             Files are preallocated and zero filled so after a crash the
+ *             valid records are followed by zeros. Files that never received
+ *             an entry are removed.
+ *
+ * @return     0 if the file was fine or was recovered, -1 on failure
+ */
+static int __recover_log_file(int index)
+{
+    char path[100];
+    int fd;
+    char* map;
+    struct stat st;
+    log_file_header_t h;
+    size_t pos, rec_len;
+    uint16_t payload_len;
+    uint64_t entries = 0;
+
+    sprintf(path, LOG_DIR "%d" LOG_FILE_EXT, index);
+    fd = open(path, O_RDWR);
+    if (fd == -1) return -1;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(h))
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.mot_1, e.mot_2, e.mot_3, e.mot_4,
-            e.mot_5, e.mot_6, e.mot_7, e.mot_8);
+        close(fd);
+        return -1;
     }
-    if (settings.log_motor_signals && settings.num_rotors == 6)
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F,%.4F,%.4F", e.mot_1, e.mot_2, e.mot_3, e.mot_4, e.mot_5,
-            e.mot_6);
+        close(fd);
+        return -1;
     }
-    if (settings.log_motor_signals && settings.num_rotors == 4)
+    memcpy(&h, map, sizeof(h));
+    if (memcmp(h.magic, LOG_FILE_MAGIC, sizeof(h.magic)) != 0 || h.version != LOG_FORMAT_VERSION)
     {
-        fprintf(fd, ",%.4F,%.4F,%.4F,%.4F", e.mot_1, e.mot_2, e.mot_3, e.mot_4);
+        // not ours to fix
+        munmap(map, st.st_size);
+        close(fd);
+        return 0;
     }
 
-    fprintf(fd, "\n");
+    // walk the records until the zero fill, a trailer, or something broken
+    pos = sizeof(h) + h.num_fields * sizeof(log_field_desc_t);
+    while (pos < (size_t)st.st_size)
+    {
+        if ((uint8_t)map[pos] == LOG_RECORD_ENTRY)
+        {
+            rec_len = h.record_len;
+            entries++;
+        }
+        else if ((uint8_t)map[pos] == LOG_RECORD_KEYFRAME ||
+                 (uint8_t)map[pos] == LOG_RECORD_DELTA || (uint8_t)map[pos] == LOG_RECORD_TIMING)
+        {
+            if (pos + 1 + sizeof(payload_len) > (size_t)st.st_size) break;
+            memcpy(&payload_len, map + pos + 1, sizeof(payload_len));
+            rec_len = 1 + sizeof(payload_len) + payload_len;
+            if ((uint8_t)map[pos] != LOG_RECORD_TIMING) entries++;
+        }
+        else if ((uint8_t)map[pos] == LOG_RECORD_TRAILER)
+            rec_len = 1 + sizeof(log_trailer_t);
+        else
+            break;
+        if (pos + rec_len > (size_t)st.st_size) break;
+        pos += rec_len;
+    }
+    munmap(map, st.st_size);
+
+    if (pos < (size_t)st.st_size)
+    {
+        if (entries == 0)
+        {
+            close(fd);
+            unlink(path);
+            return 0;
+        }
+        printf("recovered %" PRIu64 " entries from unclosed log file %d\n", entries, index);
+        if (ftruncate(fd, pos) == -1)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
     return 0;
 }
 
+/**
+ * @brief      Delete the oldest log files until the ones left fit within
+ *             log_max_files and log_max_mb. The files being written are never
+ *             removed and count only with the data written to them.
+ *
+ *             Runs in the writer thread so listing the directory never holds
+ *             up the flight controller.
+ */
+static void __enforce_retention(void)
+{
+    DIR* dir;
+    struct dirent* ent;
+    struct stat st;
+    char path[100];
+    char ext[sizeof(LOG_FILE_EXT) + 1];
+    int index, oldest;
+    int num_files = 0;
+    uint64_t total_bytes = 0;
+    uint64_t max_bytes = (uint64_t)settings.log_max_mb * 1024 * 1024;
+
+    if (settings.log_max_files == 0 && settings.log_max_mb == 0) return;
+
+    // count what is on the card and find the lowest numbered file
+    dir = opendir(LOG_DIR);
+    if (dir == NULL) return;
+    oldest = next_index;
+    while ((ent = readdir(dir)) != NULL)
+    {
+        if (sscanf(ent->d_name, "%d%5s", &index, ext) != 2) continue;
+        if (strcmp(ext, LOG_FILE_EXT) != 0) continue;
+        sprintf(path, LOG_DIR "%d" LOG_FILE_EXT, index);
+        if (stat(path, &st) != 0) continue;
+        // the file opened ahead is still empty, the current one is
+        // preallocated so only what has been written counts
+        if (next_file.fd != -1 && index == next_file.index) continue;
+        num_files++;
+        if (cur_file.fd != -1 && index == cur_file.index)
+            total_bytes += cur_file.len;
+        else
+            total_bytes += st.st_size;
+        if (index < oldest) oldest = index;
+    }
+    closedir(dir);
+
+    // delete from the oldest up, the series may have gaps
+    for (; oldest < cur_file.index; oldest++)
+    {
+        if (!((settings.log_max_files && num_files > settings.log_max_files) ||
+                (max_bytes && total_bytes > max_bytes)))
+            break;
+        sprintf(path, LOG_DIR "%d" LOG_FILE_EXT, oldest);
+        if (stat(path, &st) != 0) continue;
+        if (unlink(path) == 0)
+        {
+            num_files--;
+            total_bytes -= st.st_size;
+        }
+    }
+}
+
+/**
+ * @brief      Finish the current file and continue in the one opened ahead of
+ *             time, then open another for the next arming.
+ */
+static void __switch_segment(void)
+{
+    __close_log_file(&cur_file);
+    seg_entries = 0;
+    seg_dropped_base = atomic_load(&num_dropped);
+
+    // normally the next file is already waiting
+    if (next_file.fd == -1) __open_log_file(&next_file);
+    cur_file = next_file;
+    next_file.fd = -1;
+
+    // now that nobody is waiting, get the next one ready and make room
+    __open_log_file(&next_file);
+    __enforce_retention();
+}
+
+/**
+ * @brief      Write everything currently in the ring to disk.
+ *
+ *             Only called from the writer thread. Contiguous runs of entries
+ *             are packed straight out of the ring and written in chunks. A
+ *             chunk never spans a segment boundary.
+ */
+static void __drain_ring(void)
+{
+    uint32_t head, tail, n, i, pos;
+
+    tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+    while (tail != head)
+    {
+        pos = tail & ring_mask;
+        if (__slot(pos)->new_segment) __switch_segment();
+
+        // don't run past the end of the array, the write buffer, or the
+        // start of the next segment
+        n = head - tail;
+        if (n > ring_len - pos) n = ring_len - pos;
+        if (n > WRITE_CHUNK) n = WRITE_CHUNK;
+        for (i = 1; i < n; i++)
+        {
+            if (__slot(pos + i)->new_segment) break;
+        }
+        n = i;
+
+        if (cur_file.fd != -1) __write_entries(&cur_file, pos, n);
+        seg_entries += n;
+        tail += n;
+        atomic_store_explicit(&ring_tail, tail, memory_order_release);
+    }
+    __sync_log_file(&cur_file);
+}
+
 static void* __log_manager_func(__attribute__((unused)) void* ptr)
 {
-    int i, buf_to_write;
-    // while logging enabled and not exiting, write full buffers to disk
-    while (rc_get_state() != EXITING && logging_enabled)
+    struct timespec ts;
+    char path[100];
+
+    rt_prefault_stack();
+
+    // old flights may have piled up since the last run
+    __enforce_retention();
+
+    // while logging enabled and not exiting, write entries to disk whenever
+    // the producer signals enough have built up
+    while (rc_get_state() != EXITING && atomic_load(&logging_enabled))
     {
-        if (needs_writing)
+        // time out every so often to check if we should exit
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 1000000000 / LOG_MANAGER_HZ;
+        if (ts.tv_nsec >= 1000000000)
         {
-            // buffer to be written is opposite of one currently being filled
-            if (current_buf == 0)
-                buf_to_write = 1;
-            else
-                buf_to_write = 0;
-            // write the full buffer to disk;
-            for (i = 0; i < BUF_LEN; i++)
-            {
-                __write_log_entry(fd, buffer[buf_to_write][i]);
-            }
-            fflush(fd);
-            needs_writing = 0;
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
         }
-        rc_usleep(1000000 / LOG_MANAGER_HZ);
+        sem_timedwait(&wake_sem, &ts);
+        __drain_ring();
     }
 
     // if program is exiting or logging got disabled, write out the rest of
-    // the logs that are in the buffer current being filled
-    // printf("writing out remaining log file\n");
-    for (i = 0; i < buffer_pos; i++)
+    // the entries and the summary trailer
+    __drain_ring();
+    if (atomic_load(&num_dropped) > 0)
     {
-        __write_log_entry(fd, buffer[current_buf][i]);
+        fprintf(stderr, "WARNING: log_manager dropped %u entries, ring buffer was full\n",
+            atomic_load(&num_dropped));
     }
-    fflush(fd);
-    fclose(fd);
+    __close_log_file(&cur_file);
 
-    // zero out state
-    logging_enabled = 0;
-    num_entries = 0;
-    buffer_pos = 0;
-    current_buf = 0;
-    needs_writing = 0;
+    // the file opened ahead of time was never used, don't leave it behind
+    if (next_file.fd != -1)
+    {
+        munmap(next_file.map, next_file.size);
+        close(next_file.fd);
+        next_file.fd = -1;
+        sprintf(path, LOG_DIR "%d" LOG_FILE_EXT, next_file.index);
+        unlink(path);
+        // give its number to the next run so the series has no gaps
+        if (next_index == next_file.index + 1)
+        {
+            next_index = next_file.index;
+            __save_next_index();
+        }
+    }
+
+    atomic_store(&logging_enabled, 0);
     return NULL;
 }
 
 int log_manager_init()
 {
-    int i;
-    char path[100];
     struct stat st = {0};
 
     // if the thread if running, stop before starting a new log file
-    if (logging_enabled)
+    if (atomic_load(&logging_enabled))
     {
         // fprintf(stderr,"ERROR: in start_log_manager, log manager already running.\n");
         // return -1;
@@ -195,41 +800,56 @@ int log_manager_init()
         mkdir(LOG_DIR, 0755);
     }
 
-    // search for existing log files to determine the next number in the series
-    for (i = 1; i <= MAX_LOG_FILES + 1; i++)
+    // a crash or power loss leaves the last two files in the series at their
+    // preallocated size, find the real end of their data before going on
+    __load_next_index();
+    if (next_index > 2) __recover_log_file(next_index - 2);
+    if (next_index > 1) __recover_log_file(next_index - 1);
+
+    // segments hold log_segment_seconds of entries, rounded up to whole pages
+    __setup_fields();
+    page_size = sysconf(_SC_PAGESIZE);
+    segment_bytes = log_fields_header_len(&layout) +
+                    (size_t)layout.record_len * settings.feedback_hz * settings.log_segment_seconds;
+    segment_bytes = (segment_bytes + page_size - 1) & ~(page_size - 1);
+
+    // open the file for data up to the first arming and one for after
+    if (__open_log_file(&cur_file) == -1) return -1;
+    if (__open_log_file(&next_file) == -1)
     {
-        memset(&path, 0, sizeof(path));
-        sprintf(path, LOG_DIR "%d.csv", i);
-        // if file exists, move onto the next index
-        if (stat(path, &st) == 0)
-            continue;
-        else
-            break;
-    }
-    // limit number of log files
-    if (i == MAX_LOG_FILES + 1)
-    {
-        fprintf(stderr, "ERROR: log file limit exceeded\n");
-        fprintf(stderr, "delete old log files before continuing\n");
-        return -1;
+        fprintf(stderr, "WARNING: failed to open next log file ahead of time\n");
     }
-    // create and open new file for writing
-    fd = fopen(path, "w+");
-    if (fd == 0)
+
+    // allocate the ring once, depth rounded up to a power of two
+    if (ring == NULL)
     {
-        printf("ERROR: can't open log file for writing\n");
-        return -1;
+        ring_len = 1;
+        while (ring_len < (uint32_t)settings.log_buffer_len) ring_len <<= 1;
+        ring_mask = ring_len - 1;
+        slot_len = sizeof(log_slot_t) + layout.num * sizeof(uint64_t);
+        ring = (char*)malloc(ring_len * slot_len);
+        if (ring == NULL)
+        {
+            fprintf(stderr, "ERROR in log_manager_init, failed to allocate ring buffer\n");
+            __close_log_file(&cur_file);
+            return -1;
+        }
+        rt_prefault(ring, ring_len * slot_len);
+        sem_init(&wake_sem, 0, 0);
     }
 
-    // write header
-    __write_header(fd);
-
-    // start thread
-    logging_enabled = 1;
-    num_entries = 0;
-    buffer_pos = 0;
-    current_buf = 0;
-    needs_writing = 0;
+    // reset ring and counters, writer thread isn't running so this is safe
+    atomic_store(&ring_head, 0);
+    atomic_store(&ring_tail, 0);
+    atomic_store(&num_entries, 0);
+    atomic_store(&num_dropped, 0);
+    atomic_store(&high_water, 0);
+    atomic_store(&segment_pending, 0);
+    seg_entries = 0;
+    seg_dropped_base = 0;
+    while (sem_trywait(&wake_sem) == 0)
+        ;
+    atomic_store(&logging_enabled, 1);
 
     // start logging thread
     if (rc_pthread_create(&pthread, __log_manager_func, NULL, SCHED_FIFO, LOG_MANAGER_PRI) < 0)
@@ -241,98 +861,60 @@ int log_manager_init()
     return 0;
 }
 
-static log_entry_t __construct_new_entry()
+int log_manager_new_segment(void)
 {
-    log_entry_t l;
-    l.loop_index = fstate.loop_index;
-    l.last_step_ns = fstate.last_step_ns;
-
-    l.v_batt = state_estimate.v_batt_lp;
-    l.alt_bmp_raw = state_estimate.alt_bmp_raw;
-    l.gyro_roll = state_estimate.gyro[0];
-    l.gyro_pitch = state_estimate.gyro[1];
-    l.gyro_yaw = state_estimate.gyro[2];
-    l.accel_X = state_estimate.accel[0];
-    l.accel_Y = state_estimate.accel[1];
-    l.accel_Z = state_estimate.accel[2];
-
-    l.roll = state_estimate.tb_imu[0];
-    l.pitch = state_estimate.tb_imu[1];
-    l.yaw = state_estimate.tb_imu[2];
-    l.X = state_estimate.pos_global[0];
-    l.Y = state_estimate.pos_global[1];
-    l.Z = state_estimate.pos_global[2];
-    l.Xdot = state_estimate.vel_global[0];
-    l.Ydot = state_estimate.vel_global[1];
-    l.Zdot = state_estimate.vel_global[2];
-
-    l.sp_roll = setpoint.roll;
-    l.sp_pitch = setpoint.pitch;
-    l.sp_yaw = setpoint.yaw;
-    l.sp_X = setpoint.X;
-    l.sp_Y = setpoint.Y;
-    l.sp_Z = setpoint.Z;
-    l.sp_Xdot = setpoint.X_dot;
-    l.sp_Ydot = setpoint.Y_dot;
-    l.sp_Zdot = setpoint.Z_dot;
-
-    l.u_roll = fstate.u[VEC_ROLL];
-    l.u_pitch = fstate.u[VEC_PITCH];
-    l.u_yaw = fstate.u[VEC_YAW];
-    l.u_X = fstate.u[VEC_Y];
-    l.u_Y = fstate.u[VEC_X];
-    l.u_Z = fstate.u[VEC_Z];
-
-    l.mot_1 = fstate.m[0];
-    l.mot_2 = fstate.m[1];
-    l.mot_3 = fstate.m[2];
-    l.mot_4 = fstate.m[3];
-    l.mot_5 = fstate.m[4];
-    l.mot_6 = fstate.m[5];
-    l.mot_7 = fstate.m[6];
-    l.mot_8 = fstate.m[7];
-
-    return l;
+    if (!atomic_load_explicit(&logging_enabled, memory_order_relaxed)) return -1;
+    atomic_store_explicit(&segment_pending, 1, memory_order_relaxed);
+    return 0;
 }
 
 int log_manager_add_new()
 {
-    if (!logging_enabled)
+    uint32_t head, tail, fill;
+    log_slot_t* slot;
+
+    if (!atomic_load_explicit(&logging_enabled, memory_order_relaxed))
     {
         fprintf(stderr, "ERROR: trying to log entry while logger isn't running\n");
         return -1;
     }
-    if (needs_writing && buffer_pos >= BUF_LEN)
+
+    head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+    fill = head - tail;
+    if (fill >= ring_len)
     {
-        fprintf(stderr, "WARNING: logging buffer full, skipping log entry\n");
+        // don't print from the IMU interrupt, this gets reported at cleanup
+        atomic_fetch_add_explicit(&num_dropped, 1, memory_order_relaxed);
         return -1;
     }
-    // add to buffer and increment counters
-    buffer[current_buf][buffer_pos] = __construct_new_entry();
-    buffer_pos++;
-    num_entries++;
-    // check if we've filled a buffer
-    if (buffer_pos >= BUF_LEN)
-    {
-        buffer_pos = 0;     // reset buffer position to 0
-        needs_writing = 1;  // flag the writer to dump to disk
-        // swap buffers
-        if (current_buf == 0)
-            current_buf = 1;
-        else
-            current_buf = 0;
+
+    // fill the slot then publish it to the writer
+    slot = __slot(head);
+    log_fields_capture(&layout, slot->value);
+    slot->new_segment = atomic_exchange_explicit(&segment_pending, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+    atomic_fetch_add_explicit(&num_entries, 1, memory_order_relaxed);
+
+    fill++;
+    if (fill > atomic_load_explicit(&high_water, memory_order_relaxed))
+    {
+        atomic_store_explicit(&high_water, fill, memory_order_relaxed);
     }
+    // wake the writer once per batch rather than on every entry
+    if (fill == WAKE_THRESHOLD || fill == ring_len) sem_post(&wake_sem);
     return 0;
 }
 
 int log_manager_cleanup()
 {
     // just return if not logging
-    if (logging_enabled == 0) return 0;
+    if (atomic_load(&logging_enabled) == 0) return 0;
 
     // disable logging so the thread can stop and start multiple times
     // thread also exits on rc_get_state()==EXITING
-    logging_enabled = 0;
+    atomic_store(&logging_enabled, 0);
+    sem_post(&wake_sem);
     int ret = rc_pthread_timed_join(pthread, NULL, LOG_MANAGER_TOUT);
     if (ret == 1)
         fprintf(stderr, "WARNING: log_manager_thread exit timeout\n");
@@ -19,14 +19,23 @@
 #include <rc/start_stop.h>
 #include <rc/time.h>
 
+#include <baro_manager.h>
+#include <battery_manager.h>
+#include <blackbox.h>
+#include <deadline.h>
+#include <feedback.h>
 #include <input_manager.h>
 #include <log_manager.h>
 #include <mix.h>
 #include <printf_manager.h>
+#include <rt_harden.h>
+#include <scheduler.h>
 #include <setpoint_manager.h>
 #include <settings.h>  // contains extern settings variable
+#include <snapshot.h>
 #include <state_estimator.h>
 #include <thrust_map.h>
+#include <timing.h>
 
 #define FAIL(str)                       \
     fprintf(stderr, str);               \
@@ -102,12 +111,39 @@ void on_pause_press()
  */
 static void __imu_isr(void)
 {
+    static int stack_ready = 0;
+
+    // librobotcontrol starts this thread, so its stack is prefaulted here
+    if (!stack_ready)
+    {
+        rt_prefault_stack();
+        stack_ready = 1;
+    }
+    rt_isr_begin();
+    timing_isr_start();
     // printf("imu interupt...\n");
     setpoint_manager_update();
+    timing_mark(TIMING_SETPOINT);
     state_estimator_march();
+    timing_mark(TIMING_ESTIMATOR);
     feedback_march();
-    if (settings.enable_logging) log_manager_add_new();
-    state_estimator_jobs_after_feedback();
+    timing_mark(TIMING_FEEDBACK);
+    if (settings.enable_logging && deadline_log_due()) log_manager_add_new();
+    if (settings.enable_blackbox) blackbox_add_new();
+    snapshot_publish();
+    timing_mark(TIMING_LOG);
+    if (sched_tick() < 0 && fstate.arm_state == ARMED)
+    {
+        blackbox_trigger(BLACKBOX_SENSOR_FAULT);
+    }
+    timing_mark(TIMING_RATE_GROUPS);
+
+    // the next sample is already late if this one took a whole period
+    if (deadline_check(timing_isr_end()) && fstate.arm_state == ARMED)
+    {
+        blackbox_trigger(BLACKBOX_OVERRUN);
+    }
+    rt_isr_end();
 }
 
 /**
@@ -204,12 +240,32 @@ int main(int argc, char* argv[])
         FAIL("WARNING, can't set CPU governor, need to run as root\n")
     }
 
+    // lock memory before any threads start or buffers are allocated so all
+    // of them are locked too
+    if (settings.enable_rt_hardening)
+    {
+        printf("locking memory\n");
+        if (rt_harden_init() < 0)
+        {
+            FAIL("ERROR: failed to lock memory\n")
+        }
+    }
+
     // do initialization not involving threads
     printf("initializing thrust map\n");
-    if (thrust_map_init(settings.thrust_map) < 0)
+    if (settings.thrust_map == CUSTOM_MAP)
+    {
+        if (thrust_map_init_custom(settings.thrust_map_custom, settings.thrust_map_custom_points,
+                settings.thrust_map_lut_len) < 0)
+        {
+            FAIL("ERROR: failed to initialize custom thrust map\n")
+        }
+    }
+    else if (thrust_map_init(settings.thrust_map, settings.thrust_map_lut_len) < 0)
     {
         FAIL("ERROR: failed to initialize thrust map\n")
     }
+    printf("thrust map lookup error: %.2g\n", thrust_map_lut_error());
     printf("initializing mixing matrix\n");
     if (mix_init(settings.layout) < 0)
     {
@@ -232,6 +288,11 @@ int main(int argc, char* argv[])
     {
         FAIL("ERROR: failed to initialize ADC")
     }
+    printf("initializing battery manager\n");
+    if (battery_manager_init() < 0)
+    {
+        FAIL("ERROR: failed to initialize battery manager\n")
+    }
 
     // start signal handler so threads can exit cleanly
     printf("initializing signal handler\n");
@@ -265,12 +326,26 @@ int main(int argc, char* argv[])
         }
     }
 
+    // start the black box recorder if enabled in settings
+    if (settings.enable_blackbox)
+    {
+        printf("initializing blackbox\n");
+        if (blackbox_init() < 0)
+        {
+            FAIL("ERROR: failed to initialize blackbox\n")
+        }
+    }
+
     // start barometer, must do before starting state estimator
     printf("initializing Barometer\n");
     if (rc_bmp_init(BMP_OVERSAMPLE_16, BMP_FILTER_16))
     {
         FAIL("ERROR: failed to initialize barometer\n")
     }
+    if (baro_manager_init() < 0)
+    {
+        FAIL("ERROR: failed to initialize baro_manager\n")
+    }
 
     // set up state estimator
     printf("initializing state_estimator\n");
@@ -291,7 +366,7 @@ int main(int argc, char* argv[])
     mpu_conf.i2c_bus = I2C_BUS;
     mpu_conf.gpio_interrupt_pin_chip = GPIO_INT_PIN_CHIP;
     mpu_conf.gpio_interrupt_pin = GPIO_INT_PIN_PIN;
-    mpu_conf.dmp_sample_rate = FEEDBACK_HZ;
+    mpu_conf.dmp_sample_rate = settings.feedback_hz;
     mpu_conf.dmp_fetch_accel_gyro = 1;
     // mpu_conf.orient = ORIENTATION_Z_UP;
     mpu_conf.dmp_interrupt_sched_policy = SCHED_FIFO;
@@ -319,6 +394,13 @@ int main(int argc, char* argv[])
     printf("waiting for dmp to settle...\n");
     fflush(stdout);
     rc_usleep(3000000);
+
+    if (deadline_init() < 0)
+    {
+        FAIL("ERROR: failed to init deadline monitor\n")
+    }
+
+    // everything the IMU interrupt uses has to be allocated by now
     if (rc_mpu_set_dmp_callback(__imu_isr) != 0)
     {
         FAIL("ERROR: failed to set dmp callback function\n")
@@ -340,6 +422,13 @@ int main(int argc, char* argv[])
     rc_set_state(RUNNING);
     while (rc_get_state() != EXITING)
     {
+        // the IMU interrupt never prints, it leaves events for here
+        feedback_print_events(stdout);
+        if (settings.warnings_en)
+        {
+            state_estimator_print_events(stderr);
+            deadline_print_events(stderr);
+        }
         usleep(50000);
     }
 
@@ -348,11 +437,19 @@ int main(int argc, char* argv[])
     // cleanup functions here.
     printf("cleaning up\n");
     rc_mpu_power_off();
+    baro_manager_cleanup();
+    battery_manager_cleanup();
     feedback_cleanup();
     input_manager_cleanup();
     setpoint_manager_cleanup();
     printf_cleanup();
     log_manager_cleanup();
+    blackbox_cleanup();
+    timing_print_report(stdout);
+    sched_print_report(stdout);
+    deadline_print_report(stdout);
+    baro_manager_print_report(stdout);
+    rt_print_report(stdout);
 
     // turn off red LED and blink green to say shut down was safe
     rc_led_set(RC_LED_RED, 0);
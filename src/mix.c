@@ -4,9 +4,14 @@
 
 #include <float.h>  // for DBL_MAX
 #include <mix.h>
+#include <rc_pilot_defs.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 // clang-format off
 /**
  * Most popular: 4-rotor X layout like DJI Phantom and 3DR Iris
@@ -18,7 +23,7 @@
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-4
  */
-static double mix_4x[][6] = {
+static const double mix_4x[][6] = {
     {0.0, 0.0, -1.0, -0.5, 0.5, 0.5}, 
     {0.0, 0.0, -1.0, -0.5, -0.5, -0.5},
     {0.0, 0.0, -1.0, 0.5, -0.5, 0.5}, 
@@ -34,7 +39,7 @@ static double mix_4x[][6] = {
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-4
  */
-static double mix_4plus[][6] = {
+static const double mix_4plus[][6] = {
     {0.0, 0.0, -1.0, 0.0, 0.5, 0.5}, 
     {0.0, 0.0, -1.0, -0.5, 0.0, -0.5},
     {0.0, 0.0, -1.0, 0.0, -0.5, 0.5}, 
@@ -50,7 +55,7 @@ static double mix_4plus[][6] = {
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-6
  */
-static double mix_6x[][6] = {
+static const double mix_6x[][6] = {
     {0.0, 0.0, -1.0, -0.25, 0.5, 0.5}, 
     {0.0, 0.0, -1.0, -0.50, 0.0, -0.5},
     {0.0, 0.0, -1.0, -0.25, -0.5, 0.5}, 
@@ -69,7 +74,7 @@ static double mix_6x[][6] = {
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-8
  */
-static double mix_8x[][6] = {
+static const double mix_8x[][6] = {
     {0.0, 0.0, -1.0, -0.21, 0.50, 0.5},
     {0.0, 0.0, -1.0, -0.50, 0.21, -0.5}, 
     {0.0, 0.0, -1.0, -0.50, -0.21, 0.5},
@@ -89,7 +94,7 @@ static double mix_8x[][6] = {
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-6
  */
-static double mix_6dof_rotorbits[][6] = {
+static const double mix_6dof_rotorbits[][6] = {
     {-0.2736, 0.3638, -1.0000, -0.2293, 0.3921, 0.3443},
     {0.6362, 0.0186, -1.0000, -0.3638, -0.0297, -0.3638},
     {-0.3382, -0.3533, -1.0000, -0.3320, -0.3638, 0.3546},
@@ -107,7 +112,7 @@ static double mix_6dof_rotorbits[][6] = {
  * columns: X Y Z Roll Pitch Yaw
  * rows: motors 1-6
  */
-static double mix_6dof_5inch_monocoque[][6] = {
+static const double mix_6dof_5inch_monocoque[][6] = {
     {-0.2296, 0.2296, -1.0000, -0.2289, 0.2296, 0.2221},
     {0.4742, 0.0000, -1.0000, -0.2296, -0.0000, -0.2296},
     {-0.2296, -0.2296, -1.0000, -0.2289, -0.2296, 0.2221},
@@ -115,13 +120,330 @@ static double mix_6dof_5inch_monocoque[][6] = {
     {0.4742, -0.0000, -1.0000, 0.2296, -0.0000, 0.2296},
     {-0.2296, -0.2296, -1.0000, 0.2289, 0.2296, -0.2221}};
 
-// clang-format off
+// clang-format on
+
+/*
+ * Kernels specialized for each layout. The generic bodies below are forced
+ * inline into a pair of functions per layout with the matrix, rotor count and
+ * dof as constants. Rotor loops are unrolled by MIX_UNROLL and every matrix
+ * entry becomes a literal, so zero entries and the X/Y columns of 4dof layouts
+ * drop out at compile time. Skipping a zero entry gives the same bits as adding
+ * u*0.0 for any finite u.
+ */
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+// expand X(i) for each possible rotor, X checks i against the rotor count
+#define MIX_UNROLL(X) X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+
+typedef struct mix_kernels_t
+{
+    void (*all)(const double u[6], double* mot);
+    void (*allocate)(double u[6], const double u_max[6], const mix_input_t input[6], double* mot);
+} mix_kernels_t;
+
+ALWAYS_INLINE void __all(const double (*m)[6], const int n, const double u[6], double* mot)
+{
+    double sum;
+#define MIX_ALL_ROTOR(i)                                 \
+    if (i < n)                                           \
+    {                                                    \
+        sum = 0.0;                                       \
+        if (m[i][0] != 0.0) sum += m[i][0] * u[0];       \
+        if (m[i][1] != 0.0) sum += m[i][1] * u[1];       \
+        if (m[i][2] != 0.0) sum += m[i][2] * u[2];       \
+        if (m[i][3] != 0.0) sum += m[i][3] * u[3];       \
+        if (m[i][4] != 0.0) sum += m[i][4] * u[4];       \
+        if (m[i][5] != 0.0) sum += m[i][5] * u[5];       \
+        if (sum > 1.0)                                   \
+            sum = 1.0;                                   \
+        else if (sum < 0.0)                              \
+            sum = 0.0;                                   \
+        mot[i] = sum;                                    \
+    }
+    MIX_UNROLL(MIX_ALL_ROTOR)
+#undef MIX_ALL_ROTOR
+}
+
+/**
+ * @brief      Add channel ch to out after limiting it to the unsaturated
+ *             range, same arithmetic as mix_check_saturation + mix_add_input.
+ *             The reciprocals fold to constants so there are no divisions.
+ */
+ALWAYS_INLINE void __channel(const double (*m)[6], const int n, const int ch, const int check,
+    double u[6], const double u_max[6], const mix_input_t input[6], double* out)
+{
+    double tmp;
+    double max = DBL_MAX;
+    double min = -DBL_MAX;
+
+    // nothing has been added before the first channel, it can't saturate
+    if (check)
+    {
+#define MIX_BOUND_ROTOR(i)                        \
+    if (i < n && m[i][ch] > 0.0)                  \
+    {                                             \
+        tmp = (1.0 - out[i]) * (1.0 / m[i][ch]);  \
+        if (tmp < max) max = tmp;                 \
+        tmp = -out[i] * (1.0 / m[i][ch]);         \
+        if (tmp > min) min = tmp;                 \
+    }                                             \
+    else if (i < n && m[i][ch] < 0.0)             \
+    {                                             \
+        tmp = -out[i] * (1.0 / m[i][ch]);         \
+        if (tmp < max) max = tmp;                 \
+        tmp = (1.0 - out[i]) * (1.0 / m[i][ch]);  \
+        if (tmp > min) min = tmp;                 \
+    }
+        MIX_UNROLL(MIX_BOUND_ROTOR)
+#undef MIX_BOUND_ROTOR
+        if (max > u_max[ch]) max = u_max[ch];
+        if (min < -u_max[ch]) min = -u_max[ch];
+
+        if (input != NULL && input[ch] != NULL)
+            u[ch] = input[ch](ch, min, max);
+        else if (min <= max)
+        {
+            if (u[ch] > max)
+                u[ch] = max;
+            else if (u[ch] < min)
+                u[ch] = min;
+        }
+    }
+
+#define MIX_ADD_ROTOR(i)                          \
+    if (i < n && m[i][ch] != 0.0)                 \
+    {                                             \
+        out[i] += u[ch] * m[i][ch];               \
+        if (out[i] > 1.0)                         \
+            out[i] = 1.0;                         \
+        else if (out[i] < 0.0)                    \
+            out[i] = 0.0;                         \
+    }
+    MIX_UNROLL(MIX_ADD_ROTOR)
+#undef MIX_ADD_ROTOR
+}
 
-static double (*mix_matrix)[6];
+ALWAYS_INLINE void __allocate(const double (*m)[6], const int n, const int dof, double u[6],
+    const double u_max[6], const mix_input_t input[6], double* mot)
+{
+    int i;
+    double out[MAX_ROTORS] = {0.0};
+
+    __channel(m, n, VEC_Z, 0, u, u_max, input, out);
+    __channel(m, n, VEC_ROLL, 1, u, u_max, input, out);
+    __channel(m, n, VEC_PITCH, 1, u, u_max, input, out);
+    __channel(m, n, VEC_YAW, 1, u, u_max, input, out);
+    if (dof == 6)
+    {
+        __channel(m, n, VEC_X, 1, u, u_max, input, out);
+        __channel(m, n, VEC_Y, 1, u, u_max, input, out);
+    }
+    else
+    {
+        // channels the layout can't produce
+        u[VEC_X] = 0.0;
+        u[VEC_Y] = 0.0;
+    }
+
+    for (i = 0; i < n; i++) mot[i] = out[i];
+}
+
+#define MIX_KERNELS(name, n, dof)                                                                \
+    static void __all_##name(const double u[6], double* mot) { __all(mix_##name, n, u, mot); } \
+    static void __allocate_##name(                                                             \
+        double u[6], const double u_max[6], const mix_input_t input[6], double* mot)           \
+    {                                                                                          \
+        __allocate(mix_##name, n, dof, u, u_max, input, mot);                                  \
+    }                                                                                          \
+    static const mix_kernels_t kernels_##name = {__all_##name, __allocate_##name};
+
+MIX_KERNELS(4x, 4, 4)
+MIX_KERNELS(4plus, 4, 4)
+MIX_KERNELS(6x, 6, 4)
+MIX_KERNELS(8x, 8, 4)
+MIX_KERNELS(6dof_rotorbits, 6, 6)
+MIX_KERNELS(6dof_5inch_monocoque, 6, 6)
+
+/*
+ * Column-major copy of the matrix for the per-channel functions, built by
+ * mix_init. Each channel lists only its non-zero entries, positive ones first,
+ * with their reciprocals so saturation limits need no divisions or sign
+ * checks. The reciprocals are the same values the compiler folds into the
+ * specialized kernels so both give identical results.
+ */
+typedef struct mix_column_t
+{
+    int num_pos;                ///< entries [0,num_pos) are positive
+    int num;                    ///< total non-zero entries
+    int rotor[MAX_ROTORS];      ///< motor index of each entry
+    double coef[MAX_ROTORS];    ///< matrix entry
+    double inv[MAX_ROTORS];     ///< 1/coef
+} mix_column_t;
+
+/*
+ * Single precision copy of each column spread over MAX_ROTORS lanes for
+ * mix_allocate_f32, so every rotor runs the same arithmetic and 8 motors fit in
+ * two 4-lane NEON vectors. The sign of each entry is folded into hi/lo and
+ * lanes with a zero entry or no rotor get a huge offset so they never limit
+ * the range:
+ *   max candidate = (hi - out) * inv + hi_off
+ *   min candidate = (lo - out) * inv + lo_off
+ */
+typedef struct mix_lanes_t
+{
+    float coef[MAX_ROTORS];
+    float inv[MAX_ROTORS];
+    float hi[MAX_ROTORS];      ///< 1 for positive entries, 0 otherwise
+    float lo[MAX_ROTORS];      ///< 1 for negative entries, 0 otherwise
+    float hi_off[MAX_ROTORS];  ///< FLT_MAX for zero entries, 0 otherwise
+    float lo_off[MAX_ROTORS];  ///< -FLT_MAX for zero entries, 0 otherwise
+} mix_lanes_t;
+
+static const double (*mix_matrix)[6];
+static const mix_kernels_t* kernels;
+static mix_column_t columns[MAX_INPUTS];
+static mix_lanes_t lanes[MAX_INPUTS] __attribute__((aligned(16)));
+
+// order mix_allocate_f32 adds channels in, only the first dof are used
+static const int priority[6] = {VEC_Z, VEC_ROLL, VEC_PITCH, VEC_YAW, VEC_X, VEC_Y};
 static int initialized;
 static int rotors;
 static int dof;
 
+static void __build_columns(void)
+{
+    int i, ch, pass;
+    double m;
+    mix_column_t* c;
+
+    for (ch = 0; ch < MAX_INPUTS; ch++)
+    {
+        c = &columns[ch];
+        c->num = 0;
+        // positive entries on the first pass, negative on the second
+        for (pass = 0; pass < 2; pass++)
+        {
+            for (i = 0; i < rotors; i++)
+            {
+                m = mix_matrix[i][ch];
+                if ((pass == 0 && m > 0.0) || (pass == 1 && m < 0.0))
+                {
+                    c->rotor[c->num] = i;
+                    c->coef[c->num] = m;
+                    c->inv[c->num] = 1.0 / m;
+                    c->num++;
+                }
+            }
+            if (pass == 0) c->num_pos = c->num;
+        }
+    }
+}
+
+static void __build_lanes(void)
+{
+    int i, ch;
+    double m;
+    mix_lanes_t* l;
+
+    for (ch = 0; ch < MAX_INPUTS; ch++)
+    {
+        l = &lanes[ch];
+        for (i = 0; i < MAX_ROTORS; i++)
+        {
+            m = i < rotors ? mix_matrix[i][ch] : 0.0;
+            l->coef[i] = (float)m;
+            l->inv[i] = m != 0.0 ? (float)(1.0 / m) : 0.0f;
+            l->hi[i] = m > 0.0 ? 1.0f : 0.0f;
+            l->lo[i] = m < 0.0 ? 1.0f : 0.0f;
+            l->hi_off[i] = m != 0.0 ? 0.0f : FLT_MAX;
+            l->lo_off[i] = m != 0.0 ? 0.0f : -FLT_MAX;
+        }
+    }
+}
+
+#ifdef __ARM_NEON
+
+/**
+ * @brief      Range channel ch can use without saturating out, NEON version
+ */
+static inline void __lanes_limits(const mix_lanes_t* l, const float* out, float* min, float* max)
+{
+    float32x4_t o0 = vld1q_f32(out);
+    float32x4_t o1 = vld1q_f32(out + 4);
+    float32x4_t hi0, hi1, lo0, lo1;
+    float32x2_t r;
+
+    hi0 = vmlaq_f32(vld1q_f32(l->hi_off), vsubq_f32(vld1q_f32(l->hi), o0), vld1q_f32(l->inv));
+    hi1 = vmlaq_f32(
+        vld1q_f32(l->hi_off + 4), vsubq_f32(vld1q_f32(l->hi + 4), o1), vld1q_f32(l->inv + 4));
+    lo0 = vmlaq_f32(vld1q_f32(l->lo_off), vsubq_f32(vld1q_f32(l->lo), o0), vld1q_f32(l->inv));
+    lo1 = vmlaq_f32(
+        vld1q_f32(l->lo_off + 4), vsubq_f32(vld1q_f32(l->lo + 4), o1), vld1q_f32(l->inv + 4));
+
+    hi0 = vminq_f32(hi0, hi1);
+    r = vpmin_f32(vget_low_f32(hi0), vget_high_f32(hi0));
+    *max = vget_lane_f32(vpmin_f32(r, r), 0);
+    lo0 = vmaxq_f32(lo0, lo1);
+    r = vpmax_f32(vget_low_f32(lo0), vget_high_f32(lo0));
+    *min = vget_lane_f32(vpmax_f32(r, r), 0);
+}
+
+/**
+ * @brief      out = clamp(out + u * coef, 0, 1), NEON version
+ */
+static inline void __lanes_add(const mix_lanes_t* l, float u, float* out)
+{
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t one = vdupq_n_f32(1.0f);
+    float32x4_t o0 = vmlaq_n_f32(vld1q_f32(out), vld1q_f32(l->coef), u);
+    float32x4_t o1 = vmlaq_n_f32(vld1q_f32(out + 4), vld1q_f32(l->coef + 4), u);
+
+    vst1q_f32(out, vminq_f32(vmaxq_f32(o0, zero), one));
+    vst1q_f32(out + 4, vminq_f32(vmaxq_f32(o1, zero), one));
+}
+
+#else
+
+/**
+ * @brief      Range channel ch can use without saturating out, scalar version
+ */
+static inline void __lanes_limits(const mix_lanes_t* l, const float* out, float* min, float* max)
+{
+    int i;
+    float hi, lo;
+
+    *max = FLT_MAX;
+    *min = -FLT_MAX;
+    for (i = 0; i < MAX_ROTORS; i++)
+    {
+        hi = (l->hi[i] - out[i]) * l->inv[i] + l->hi_off[i];
+        lo = (l->lo[i] - out[i]) * l->inv[i] + l->lo_off[i];
+        if (hi < *max) *max = hi;
+        if (lo > *min) *min = lo;
+    }
+}
+
+/**
+ * @brief      out = clamp(out + u * coef, 0, 1), scalar version
+ */
+static inline void __lanes_add(const mix_lanes_t* l, float u, float* out)
+{
+    int i;
+    float tmp;
+
+    for (i = 0; i < MAX_ROTORS; i++)
+    {
+        tmp = out[i] + u * l->coef[i];
+        if (tmp > 1.0f)
+            tmp = 1.0f;
+        else if (tmp < 0.0f)
+            tmp = 0.0f;
+        out[i] = tmp;
+    }
+}
+
+#endif  // __ARM_NEON
+
 int mix_init(rotor_layout_t layout)
 {
     switch (layout)
@@ -130,67 +452,57 @@ int mix_init(rotor_layout_t layout)
             rotors = 4;
             dof = 4;
             mix_matrix = mix_4x;
+            kernels = &kernels_4x;
             break;
         case LAYOUT_4PLUS:
             rotors = 4;
             dof = 4;
             mix_matrix = mix_4plus;
+            kernels = &kernels_4plus;
             break;
         case LAYOUT_6X:
             rotors = 6;
             dof = 4;
             mix_matrix = mix_6x;
+            kernels = &kernels_6x;
             break;
         case LAYOUT_8X:
             rotors = 8;
             dof = 4;
             mix_matrix = mix_8x;
+            kernels = &kernels_8x;
             break;
         case LAYOUT_6DOF_ROTORBITS:
             rotors = 6;
             dof = 6;
             mix_matrix = mix_6dof_rotorbits;
+            kernels = &kernels_6dof_rotorbits;
             break;
         case LAYOUT_6DOF_5INCH_MONOCOQUE:
             rotors = 6;
             dof = 6;
             mix_matrix = mix_6dof_5inch_monocoque;
+            kernels = &kernels_6dof_5inch_monocoque;
             break;
         default:
             fprintf(stderr, "ERROR in mix_init() unknown rotor layout\n");
             return -1;
     }
 
+    __build_columns();
+    __build_lanes();
     initialized = 1;
     return 0;
 }
 
 int mix_all_controls(double u[6], double* mot)
 {
-    int i, j;
     if (initialized != 1)
     {
         fprintf(stderr, "ERROR in mix_all_controls, mixing matrix not set yet\n");
         return -1;
     }
-    // sum control inputs
-    for (i = 0; i < rotors; i++)
-    {
-        mot[i] = 0.0;
-        for (j = 0; j < 6; j++)
-        {
-            mot[i] += mix_matrix[i][j] * u[j];
-        }
-    }
-    // ensure saturation, should not need to do this if mix_check_saturation
-    // was used properly, but here for safety anyway.
-    for (i = 0; i < rotors; i++)
-    {
-        if (mot[i] > 1.0)
-            mot[i] = 1.0;
-        else if (mot[i] < 0.0)
-            mot[i] = 0.0;
-    }
+    kernels->all(u, mot);
     return 0;
 }
 
@@ -198,6 +510,7 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
 {
     int i, min_ch;
     double tmp;
+    const mix_column_t* c;
     double new_max = DBL_MAX;
     double new_min = -DBL_MAX;
 
@@ -237,32 +550,22 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
         }
     }
 
-    // find max positive input
-    for (i = 0; i < rotors; i++)
+    // positive entries saturate high when the input is positive and low when
+    // negative, negative entries the other way around
+    c = &columns[ch];
+    for (i = 0; i < c->num_pos; i++)
     {
-        // if mix channel is 0, impossible to saturate
-        if (mix_matrix[i][ch] == 0.0) continue;
-        // for positive entry in mix matrix
-        if (mix_matrix[i][ch] > 0.0) tmp = (1.0 - mot[i]) / mix_matrix[i][ch];
-        // for negative entry in mix matrix
-        else
-            tmp = -mot[i] / mix_matrix[i][ch];
-        // set new upper limit if lower than current
-        if (tmp < new_max) new_max = tmp;
+        tmp = (1.0 - mot[c->rotor[i]]) * c->inv[i];
+        new_max = tmp < new_max ? tmp : new_max;
+        tmp = -mot[c->rotor[i]] * c->inv[i];
+        new_min = tmp > new_min ? tmp : new_min;
     }
-
-    // find min (most negative) input
-    for (i = 0; i < rotors; i++)
+    for (; i < c->num; i++)
     {
-        // if mix channel is 0, impossible to saturate
-        if (mix_matrix[i][ch] == 0.0) continue;
-        // for positive entry in mix matrix
-        if (mix_matrix[i][ch] > 0.0) tmp = -mot[i] / mix_matrix[i][ch];
-        // for negative entry in mix matrix
-        else
-            tmp = (1.0 - mot[i]) / mix_matrix[i][ch];
-        // set new upper limit if lower than current
-        if (tmp > new_min) new_min = tmp;
+        tmp = -mot[c->rotor[i]] * c->inv[i];
+        new_max = tmp < new_max ? tmp : new_max;
+        tmp = (1.0 - mot[c->rotor[i]]) * c->inv[i];
+        new_min = tmp > new_min ? tmp : new_min;
     }
 
     *min = new_min;
@@ -272,8 +575,9 @@ int mix_check_saturation(int ch, double* mot, double* min, double* max)
 
 int mix_add_input(double u, int ch, double* mot)
 {
-    int i;
+    int i, j;
     int min_ch;
+    const mix_column_t* c;
 
     if (initialized != 1 || dof == 0)
     {
@@ -299,16 +603,75 @@ int mix_add_input(double u, int ch, double* mot)
         return -1;
     }
 
-    // add inputs
-    for (i = 0; i < rotors; i++)
+    // add inputs, motors with a zero entry don't change
+    c = &columns[ch];
+    for (i = 0; i < c->num; i++)
     {
-        mot[i] += u * mix_matrix[i][ch];
+        j = c->rotor[i];
+        mot[j] += u * c->coef[i];
         // ensure saturation, should not need to do this if mix_check_saturation
         // was used properly, but here for safety anyway.
-        if (mot[i] > 1.0)
-            mot[i] = 1.0;
-        else if (mot[i] < 0.0)
-            mot[i] = 0.0;
+        if (mot[j] > 1.0)
+            mot[j] = 1.0;
+        else if (mot[j] < 0.0)
+            mot[j] = 0.0;
+    }
+    return 0;
+}
+
+int mix_allocate(double u[6], const double u_max[6], const mix_input_t input[6], double* mot)
+{
+    if (initialized != 1)
+    {
+        fprintf(stderr, "ERROR in mix_allocate, mixing matrix not set yet\n");
+        return -1;
     }
+    kernels->allocate(u, u_max, input, mot);
+    return 0;
+}
+
+int mix_allocate_f32(double u[6], const double u_max[6], const mix_input_t input[6], float* mot)
+{
+    int i, j, ch;
+    float min, max, lim, uf;
+    float out[MAX_ROTORS] __attribute__((aligned(16))) = {0.0f};
+
+    if (initialized != 1)
+    {
+        fprintf(stderr, "ERROR in mix_allocate_f32, mixing matrix not set yet\n");
+        return -1;
+    }
+
+    __lanes_add(&lanes[VEC_Z], (float)u[VEC_Z], out);
+
+    for (j = 1; j < dof; j++)
+    {
+        ch = priority[j];
+        __lanes_limits(&lanes[ch], out, &min, &max);
+        lim = (float)u_max[ch];
+        if (max > lim) max = lim;
+        if (min < -lim) min = -lim;
+
+        if (input != NULL && input[ch] != NULL)
+            uf = (float)input[ch](ch, min, max);
+        else
+        {
+            uf = (float)u[ch];
+            if (min <= max)
+            {
+                if (uf > max)
+                    uf = max;
+                else if (uf < min)
+                    uf = min;
+            }
+        }
+        u[ch] = uf;
+        __lanes_add(&lanes[ch], uf, out);
+    }
+
+    // channels the layout can't produce
+    for (j = dof; j < 6; j++) u[priority[j]] = 0.0;
+
+    for (i = 0; i < rotors; i++) mot[i] = out[i];
     return 0;
 }
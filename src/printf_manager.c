@@ -3,21 +3,27 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <rc/pthread.h>
 #include <rc/start_stop.h>
 #include <rc/time.h>
 
+#include <deadline.h>
 #include <feedback.h>
 #include <input_manager.h>
 #include <printf_manager.h>
 #include <rc_pilot_defs.h>
+#include <rt_harden.h>
 #include <setpoint_manager.h>
 #include <settings.h>
+#include <snapshot.h>
 #include <state_estimator.h>
 #include <thread_defs.h>
+#include <timing.h>
 
 static pthread_t printf_manager_thread;
 static int initialized = 0;
@@ -87,6 +93,10 @@ static int __print_header()
             printf("  M%d |", i + 1);
         }
     }
+    if (settings.printf_timing)
+    {
+        printf("%s isr99|isrmax|jitter|ovrun|dg|", __next_colour());
+    }
     printf(KNRM);
     if (settings.printf_mode)
     {
@@ -101,7 +111,13 @@ static int __print_header()
 static void* __printf_manager_func(__attribute__((unused)) void* ptr)
 {
     arm_state_t prev_arm_state;
-    int i;
+    int i, paused = 0;
+    snapshot_t snap;
+    user_input_t input;
+    timing_stats_t total, period;
+    double jitter;
+
+    rt_prefault_stack();
     initialized = 1;
     printf("\nTurn your transmitter kill switch to arm.\n");
     printf("Then move throttle UP then DOWN to arm controller\n\n");
@@ -112,13 +128,38 @@ static void* __printf_manager_func(__attribute__((unused)) void* ptr)
     // print the header
     __print_header();
 
-    prev_arm_state = fstate.arm_state;
+    memset(&snap, 0, sizeof(snap));
+    memset(&input, 0, sizeof(input));
+    prev_arm_state = DISARMED;
 
     // sleep so state_estimator can run first
     rc_usleep(100000);
 
     while (rc_get_state() != EXITING)
     {
+        // consistent copies, on failure print the last ones again
+        snapshot_get(&snap);
+        input_manager_get_latest(&input);
+
+        // printing takes CPU time between IMU callbacks, so stay quiet while
+        // the callback is overrunning and start over with a header after
+        if (snap.deadline.level >= DEGRADE_PAUSE_PRINTF)
+        {
+            if (!paused)
+            {
+                printf("\n%sprintf paused, IMU callback overrunning%s\n", KRED, KNRM);
+                fflush(stdout);
+                paused = 1;
+            }
+            rc_usleep(1000000 / PRINTF_MANAGER_HZ);
+            continue;
+        }
+        if (paused)
+        {
+            __print_header();
+            paused = 0;
+        }
+
         // re-print header on disarming
         // if(fstate.arm_state==DISARMED && prev_arm_state==ARMED){
         //	__print_header();
@@ -127,7 +168,7 @@ static void* __printf_manager_func(__attribute__((unused)) void* ptr)
         printf("\r");
         if (settings.printf_arm)
         {
-            if (fstate.arm_state == ARMED)
+            if (snap.fstate.arm_state == ARMED)
                 printf("%s ARMED %s |", KRED, KNRM);
             else
                 printf("%sDISARMED%s|", KGRN, KNRM);
@@ -135,51 +176,68 @@ static void* __printf_manager_func(__attribute__((unused)) void* ptr)
         __reset_colour();
         if (settings.printf_altitude)
         {
-            printf("%s%+5.2f |%+5.2f |", __next_colour(), state_estimate.alt_bmp,
-                state_estimate.alt_bmp_vel);
+            printf(
+                "%s%+5.2f |%+5.2f |", __next_colour(), snap.state.alt_bmp, snap.state.alt_bmp_vel);
         }
         if (settings.printf_rpy)
         {
             printf(KCYN);
-            printf("%s%+5.2f|%+5.2f|%+5.2f|", __next_colour(), state_estimate.roll,
-                state_estimate.pitch, state_estimate.continuous_yaw);
+            printf("%s%+5.2f|%+5.2f|%+5.2f|", __next_colour(), snap.state.roll, snap.state.pitch,
+                snap.state.continuous_yaw);
         }
         if (settings.printf_sticks)
         {
-            if (user_input.requested_arm_mode == ARMED)
+            if (input.requested_arm_mode == ARMED)
                 printf("%s ARMED  ", KRED);
             else
                 printf("%sDISARMED", KGRN);
             printf(KGRN);
-            printf("%s|%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(), user_input.thr_stick,
-                user_input.roll_stick, user_input.pitch_stick, user_input.yaw_stick);
+            printf("%s|%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(), input.thr_stick,
+                input.roll_stick, input.pitch_stick, input.yaw_stick);
         }
         if (settings.printf_setpoint)
         {
-            printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(), setpoint.Z, setpoint.roll,
-                setpoint.pitch, setpoint.yaw);
+            printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(), snap.setpoint.Z,
+                snap.setpoint.roll, snap.setpoint.pitch, snap.setpoint.yaw);
         }
         if (settings.printf_u)
         {
-            printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(), fstate.u[0],
-                fstate.u[1], fstate.u[2], fstate.u[3], fstate.u[4], fstate.u[5]);
+            printf("%s%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|%+5.2f|", __next_colour(),
+                snap.fstate.u[0], snap.fstate.u[1], snap.fstate.u[2], snap.fstate.u[3],
+                snap.fstate.u[4], snap.fstate.u[5]);
         }
         if (settings.printf_motors)
         {
             printf("%s", __next_colour());
             for (i = 0; i < settings.num_rotors; i++)
             {
-                printf("%+5.2f|", fstate.m[i]);
+                printf("%+5.2f|", snap.fstate.m[i]);
+            }
+        }
+        if (settings.printf_timing)
+        {
+            // microseconds, jitter is the worst period error either way
+            timing_get_stats(TIMING_TOTAL, &total);
+            timing_get_stats(TIMING_PERIOD, &period);
+            jitter = 0.0;
+            if (period.count)
+            {
+                jitter = period.max_ns - 1e9 / settings.feedback_hz;
+                if (1e9 / settings.feedback_hz - period.min_ns > jitter)
+                    jitter = 1e9 / settings.feedback_hz - period.min_ns;
             }
+            printf("%s%6.0f|%6.0f|%6.0f|%5" PRIu64 "|%2" PRIu64 "|", __next_colour(),
+                total.p99_ns / 1e3, total.max_ns / 1e3, jitter / 1e3, snap.deadline.overruns,
+                snap.deadline.level);
         }
         printf(KNRM);
         if (settings.printf_mode)
         {
-            print_flight_mode(user_input.flight_mode);
+            print_flight_mode(input.flight_mode);
         }
 
         fflush(stdout);
-        prev_arm_state = fstate.arm_state;
+        prev_arm_state = snap.fstate.arm_state;
         rc_usleep(1000000 / PRINTF_MANAGER_HZ);
     }
 
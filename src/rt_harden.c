@@ -0,0 +1,206 @@
+/**
+ * @file rt_harden.c
+ */
+
+#define _GNU_SOURCE  // for pthread_setattr_default_np and RUSAGE_THREAD
+#include <malloc.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <rt_harden.h>
+#include <thread_defs.h>
+
+// lock new mappings as their pages are first touched rather than populating
+// them whole in mmap, Linux 4.4 and later
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+#define HEAP_PREFAULT (4 * 1024 * 1024)  // heap faulted in up front for small allocations
+
+#ifdef DEBUG
+// glibc's own allocator entry points, the wrappers below forward to them
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+// per thread so only heap calls made by the IMU interrupt thread count
+static __thread int in_isr;
+static __thread int heap_calls;
+static __thread void* first_caller;
+
+static long start_minflt, start_majflt;
+
+// totals, only written from the IMU interrupt
+static uint64_t isr_count;
+static uint64_t isr_flagged;
+static uint64_t isr_heap_calls;
+static uint64_t isr_minflt;
+static uint64_t isr_majflt;
+
+static inline void __note_heap_call(void* caller)
+{
+    if (!in_isr) return;
+    if (heap_calls++ == 0) first_caller = caller;
+}
+
+void* malloc(size_t size)
+{
+    __note_heap_call(__builtin_return_address(0));
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    __note_heap_call(__builtin_return_address(0));
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    __note_heap_call(__builtin_return_address(0));
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    if (ptr != NULL) __note_heap_call(__builtin_return_address(0));
+    __libc_free(ptr);
+}
+#endif
+
+int rt_harden_init(void)
+{
+    pthread_attr_t attr;
+    void* heap;
+
+    // keep freed memory in the heap for reuse and never serve an allocation
+    // with its own mmap, either would fault pages in again later
+    if (mallopt(M_TRIM_THRESHOLD, -1) == 0 || mallopt(M_MMAP_MAX, 0) == 0)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, failed to configure malloc\n");
+        return -1;
+    }
+
+    // every new thread gets a locked stack, including the ones librobotcontrol
+    // starts, so don't let them default to 8MB each
+    if (pthread_attr_init(&attr) != 0)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, failed to init thread attributes\n");
+        return -1;
+    }
+    if (pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE) != 0 ||
+        pthread_setattr_default_np(&attr) != 0)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, failed to set default stack size\n");
+        pthread_attr_destroy(&attr);
+        return -1;
+    }
+    pthread_attr_destroy(&attr);
+
+    // make everything mapped so far resident and locked, including the code
+    // and data of rc_pilot and its libraries. MCL_ONFAULT would apply to these
+    // too if passed here, so it only goes with MCL_FUTURE below.
+    if (mlockall(MCL_CURRENT) == -1)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, mlockall failed, need to run as root\n");
+        return -1;
+    }
+
+    // a new mapping is only locked page by page as it is touched, so the log
+    // file mappings don't get read in and pinned whole. Thread stacks and
+    // buffers the IMU interrupt uses must be touched up front with
+    // rt_prefault_stack and rt_prefault instead. Without MCL_CURRENT this
+    // leaves the mappings locked above alone.
+    if (mlockall(MCL_FUTURE | MCL_ONFAULT) == -1)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, mlockall of future mappings failed\n");
+        munlockall();
+        return -1;
+    }
+
+    // grow the heap and fault it in once, nothing is trimmed so the small
+    // allocations made during init reuse these locked pages
+    heap = malloc(HEAP_PREFAULT);
+    if (heap == NULL)
+    {
+        fprintf(stderr, "ERROR in rt_harden_init, failed to allocate heap\n");
+        return -1;
+    }
+    rt_prefault(heap, HEAP_PREFAULT);
+    free(heap);
+    return 0;
+}
+
+void rt_prefault(void* buf, size_t len)
+{
+    volatile unsigned char* p = buf;
+    size_t i, page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (len == 0) return;
+    for (i = 0; i < len; i += page) p[i] = p[i];
+    p[len - 1] = p[len - 1];
+}
+
+void rt_prefault_stack(void)
+{
+    volatile unsigned char stack[THREAD_STACK_PREFAULT];
+    size_t i, page = (size_t)sysconf(_SC_PAGESIZE);
+
+    for (i = 0; i < sizeof(stack); i += page) stack[i] = 0;
+}
+
+void rt_isr_begin(void)
+{
+#ifdef DEBUG
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    start_minflt = ru.ru_minflt;
+    start_majflt = ru.ru_majflt;
+    heap_calls = 0;
+    in_isr = 1;
+#endif
+}
+
+void rt_isr_end(void)
+{
+#ifdef DEBUG
+    struct rusage ru;
+    long minflt, majflt;
+
+    in_isr = 0;
+    getrusage(RUSAGE_THREAD, &ru);
+    minflt = ru.ru_minflt - start_minflt;
+    majflt = ru.ru_majflt - start_majflt;
+    isr_count++;
+    if (heap_calls == 0 && minflt == 0 && majflt == 0) return;
+
+    isr_flagged++;
+    isr_heap_calls += heap_calls;
+    isr_minflt += minflt;
+    isr_majflt += majflt;
+    if (isr_flagged == 1)
+    {
+        fprintf(stderr, "WARNING: IMU callback %llu made %d heap calls (first from %p) ",
+            (unsigned long long)isr_count, heap_calls, first_caller);
+        fprintf(stderr, "and took %ld minor, %ld major page faults\n", minflt, majflt);
+    }
+#endif
+}
+
+void rt_print_report(__attribute__((unused)) FILE* fp)
+{
+#ifdef DEBUG
+    fprintf(fp, "\nIMU callback heap calls and page faults\n");
+    fprintf(fp, "%llu of %llu callbacks flagged, %llu heap calls, %llu minor, %llu major faults\n",
+        (unsigned long long)isr_flagged, (unsigned long long)isr_count,
+        (unsigned long long)isr_heap_calls, (unsigned long long)isr_minflt,
+        (unsigned long long)isr_majflt);
+#endif
+}
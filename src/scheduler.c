@@ -0,0 +1,238 @@
+/**
+ * @file scheduler.c
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <rc/time.h>
+
+#include <rc_pilot_defs.h>
+#include <scheduler.h>
+#include <settings.h>
+
+typedef struct sched_task_t
+{
+    const char* name;
+    sched_func_t func;
+    int div;    ///< runs every div ticks
+    int phase;  ///< on the ticks where tick % div == phase
+    int group;  ///< index into groups
+    uint32_t runs;
+    uint32_t fails;
+    uint64_t sum_ns;
+    uint32_t max_ns;
+} sched_task_t;
+
+// all tasks of one rate, times are for the whole group on a tick it runs
+typedef struct sched_group_t
+{
+    int div;
+    uint32_t runs;
+    uint64_t sum_ns;
+    uint32_t max_ns;
+} sched_group_t;
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static int num_tasks;
+static sched_group_t groups[SCHED_MAX_TASKS];
+static int num_groups;
+
+// number of tasks due on each tick, the pattern repeats after hyper ticks which
+// is at most the number of ticks in a second
+static int tick_load[MAX_FEEDBACK_HZ];
+static int hyper = 1;
+
+static uint32_t tick;
+static uint32_t slot_runs[MAX_FEEDBACK_HZ];
+static uint64_t slot_sum_ns[MAX_FEEDBACK_HZ];
+static uint32_t slot_max_ns[MAX_FEEDBACK_HZ];
+
+static int __gcd(int a, int b)
+{
+    int t;
+    while (b != 0)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * @brief      Phase whose busiest tick has the fewest tasks, then the one
+ *             sharing the fewest ticks with other tasks, earliest on a tie
+ */
+static int __least_loaded_phase(int div)
+{
+    int p, t, worst, sum, best = 0;
+    int best_worst = SCHED_MAX_TASKS + 1, best_sum = 0;
+
+    for (p = 0; p < div; p++)
+    {
+        worst = 0;
+        sum = 0;
+        for (t = p; t < settings.feedback_hz; t += div)
+        {
+            if (tick_load[t] > worst) worst = tick_load[t];
+            sum += tick_load[t];
+        }
+        if (worst < best_worst || (worst == best_worst && sum < best_sum))
+        {
+            best_worst = worst;
+            best_sum = sum;
+            best = p;
+        }
+    }
+    return best;
+}
+
+int sched_add(const char* name, sched_func_t func, int hz, int phase)
+{
+    int i, div;
+    sched_task_t* task;
+
+    if (num_tasks >= SCHED_MAX_TASKS)
+    {
+        fprintf(stderr, "ERROR in sched_add, more than %d tasks\n", SCHED_MAX_TASKS);
+        return -1;
+    }
+    if (func == NULL || hz <= 0)
+    {
+        fprintf(stderr, "ERROR in sched_add, %s needs a function and a rate\n", name);
+        return -1;
+    }
+    // closest rate the loop can run at exactly, so the pattern of due tasks
+    // still repeats every second, every tick if it's faster than the loop
+    div = 1;
+    for (i = 2; i <= settings.feedback_hz; i++)
+    {
+        if (settings.feedback_hz % i != 0) continue;
+        if (fabs((double)settings.feedback_hz / i - hz) <
+            fabs((double)settings.feedback_hz / div - hz))
+            div = i;
+    }
+    if (settings.feedback_hz != hz * div && settings.warnings_en)
+    {
+        fprintf(stderr, "WARNING: %s runs at %dHz, %dHz doesn't divide the loop rate\n", name,
+            settings.feedback_hz / div, hz);
+    }
+    if (phase == SCHED_AUTO_PHASE)
+        phase = __least_loaded_phase(div);
+    else if (phase < 0 || phase >= div)
+    {
+        fprintf(stderr, "ERROR in sched_add, %s phase must be 0 to %d\n", name, div - 1);
+        return -1;
+    }
+
+    task = &tasks[num_tasks];
+    task->name = name;
+    task->func = func;
+    task->div = div;
+    task->phase = phase;
+
+    // join the group for this rate, or start one
+    for (i = 0; i < num_groups; i++)
+    {
+        if (groups[i].div == div) break;
+    }
+    if (i == num_groups)
+    {
+        groups[i].div = div;
+        num_groups++;
+    }
+    task->group = i;
+
+    for (i = phase; i < settings.feedback_hz; i += div) tick_load[i]++;
+    hyper = hyper / __gcd(hyper, div) * div;
+    num_tasks++;
+    return 0;
+}
+
+int sched_tick(void)
+{
+    int i, ret = 0;
+    int slot = tick % hyper;
+    uint64_t start, t0, t1;
+    uint32_t ns;
+    uint64_t group_ns[SCHED_MAX_TASKS] = {0};
+    uint32_t group_ran = 0;
+
+    start = rc_nanos_since_boot();
+    t0 = start;
+    for (i = 0; i < num_tasks; i++)
+    {
+        sched_task_t* task = &tasks[i];
+        if (tick % task->div != (uint32_t)task->phase) continue;
+
+        if (task->func() < 0)
+        {
+            task->fails++;
+            ret = -1;
+        }
+        t1 = rc_nanos_since_boot();
+        ns = (uint32_t)(t1 - t0);
+        t0 = t1;
+
+        task->runs++;
+        task->sum_ns += ns;
+        if (ns > task->max_ns) task->max_ns = ns;
+        group_ns[task->group] += ns;
+        group_ran |= 1u << task->group;
+    }
+
+    for (i = 0; i < num_groups; i++)
+    {
+        if (!(group_ran & (1u << i))) continue;
+        groups[i].runs++;
+        groups[i].sum_ns += group_ns[i];
+        if (group_ns[i] > groups[i].max_ns) groups[i].max_ns = (uint32_t)group_ns[i];
+    }
+
+    ns = (uint32_t)(t0 - start);
+    slot_runs[slot]++;
+    slot_sum_ns[slot] += ns;
+    if (ns > slot_max_ns[slot]) slot_max_ns[slot] = ns;
+
+    // keep the tick counter a multiple of hyper when it wraps
+    tick++;
+    if (tick == (UINT32_MAX / hyper) * hyper) tick = 0;
+    return ret;
+}
+
+void sched_print_report(FILE* fp)
+{
+    int i, worst = 0;
+    sched_task_t* task;
+
+    if (num_tasks == 0) return;
+
+    fprintf(fp, "\nRate group tasks (us)\n");
+    fprintf(fp, "%-14s %5s %5s %9s %6s %8s %8s\n", "task", "hz", "phase", "runs", "fails",
+        "mean", "max");
+    for (i = 0; i < num_tasks; i++)
+    {
+        task = &tasks[i];
+        fprintf(fp, "%-14s %5d %5d %9u %6u %8.1f %8.1f\n", task->name,
+            settings.feedback_hz / task->div, task->phase, task->runs, task->fails,
+            task->runs ? task->sum_ns / 1e3 / task->runs : 0.0, task->max_ns / 1e3);
+    }
+
+    fprintf(fp, "%-14s %5s %5s %9s %6s %8s %8s\n", "group", "hz", "", "runs", "", "mean", "max");
+    for (i = 0; i < num_groups; i++)
+    {
+        fprintf(fp, "%-14s %5d %5s %9u %6s %8.1f %8.1f\n", "",
+            settings.feedback_hz / groups[i].div, "", groups[i].runs, "",
+            groups[i].runs ? groups[i].sum_ns / 1e3 / groups[i].runs : 0.0, groups[i].max_ns / 1e3);
+    }
+
+    for (i = 1; i < hyper; i++)
+    {
+        if (slot_max_ns[i] > slot_max_ns[worst]) worst = i;
+    }
+    fprintf(fp, "worst tick %d of %d: %d tasks, mean %.1f max %.1f\n", worst, hyper,
+        tick_load[worst], slot_runs[worst] ? slot_sum_ns[worst] / 1e3 / slot_runs[worst] : 0.0,
+        slot_max_ns[worst] / 1e3);
+}
@@ -9,6 +9,7 @@
 
 #include <rc/start_stop.h>
 
+#include <blackbox.h>
 #include <feedback.h>
 #include <flight_mode.h>
 #include <input_manager.h>
@@ -21,11 +22,14 @@
 
 setpoint_t setpoint;  // extern variable in setpoint_manager.h
 
+// user input for this tick, keeps the previous one if the DSM callback was busy
+static user_input_t input;
+
 void __update_yaw(void)
 {
     // if throttle stick is down all the way, probably landed, so
     // keep the yaw setpoint at current yaw so it takes off straight
-    if (user_input.thr_stick < -0.95)
+    if (input.thr_stick < -0.95)
     {
         setpoint.yaw = state_estimate.yaw;
         setpoint.yaw_dot = 0.0;
@@ -33,8 +37,8 @@ void __update_yaw(void)
     }
     // otherwise, scale yaw_rate by max yaw rate in rad/s
     // and move yaw setpoint
-    setpoint.yaw_dot = user_input.yaw_stick * MAX_YAW_RATE;
-    setpoint.yaw += setpoint.yaw_dot * DT;
+    setpoint.yaw_dot = input.yaw_stick * MAX_YAW_RATE;
+    setpoint.yaw += setpoint.yaw_dot * settings.dt;
     return;
 }
 
@@ -48,8 +52,8 @@ void __update_Z(void)
         setpoint.Z_dot = 0.0;
         return;
     }
-    setpoint.Z_dot = -user_input.thr_stick * settings.max_Z_velocity;
-    setpoint.Z += setpoint.Z_dot * DT;
+    setpoint.Z_dot = -input.thr_stick * settings.max_Z_velocity;
+    setpoint.Z += setpoint.Z_dot * settings.dt;
     return;
 }
 
@@ -69,7 +73,7 @@ void __update_XY_pos(void)
     }
     else
     {
-        setpoint.X += setpoint.X_dot * DT;
+        setpoint.X += setpoint.X_dot * settings.dt;
     }
 
     if (setpoint.Y > (state_estimate.Y + XYZ_MAX_ERROR))
@@ -86,7 +90,7 @@ void __update_XY_pos(void)
     }
     else
     {
-        setpoint.Y += setpoint.Y_dot * DT;
+        setpoint.Y += setpoint.Y_dot * settings.dt;
     }
 
     return;
@@ -112,7 +116,8 @@ int setpoint_manager_update(void)
         return -1;
     }
 
-    if (user_input.initialized == 0)
+    input_manager_get_latest(&input);
+    if (input.initialized == 0)
     {
         fprintf(stderr, "ERROR in setpoint_manager_update, input_manager not initialized yet\n");
         return -1;
@@ -122,14 +127,18 @@ int setpoint_manager_update(void)
     if (rc_get_state() != RUNNING) return 0;
 
     // shutdown feedback on kill switch
-    if (user_input.requested_arm_mode == DISARMED)
+    if (input.requested_arm_mode == DISARMED)
     {
-        if (fstate.arm_state == ARMED) feedback_disarm();
+        if (fstate.arm_state == ARMED)
+        {
+            blackbox_trigger(BLACKBOX_KILL_SWITCH);
+            feedback_disarm();
+        }
         return 0;
     }
 
     // finally, switch between flight modes and adjust setpoint properly
-    switch (user_input.flight_mode)
+    switch (input.flight_mode)
     {
         case TEST_BENCH_4DOF:
             // configure which controllers are enabled
@@ -139,13 +148,13 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.roll_throttle = user_input.roll_stick;
-            setpoint.pitch_throttle = user_input.pitch_stick;
-            setpoint.yaw_throttle = user_input.yaw_stick;
-            setpoint.Z_throttle = -user_input.thr_stick;
+            setpoint.roll_throttle = input.roll_stick;
+            setpoint.pitch_throttle = input.pitch_stick;
+            setpoint.yaw_throttle = input.yaw_stick;
+            setpoint.Z_throttle = -input.thr_stick;
             // TODO add these two throttle modes as options to settings, I use a radio
             // with self-centering throttle so having 0 in the middle is safest
-            // setpoint.Z_throttle = -(user_input.thr_stick+1.0)/2.0;
+            // setpoint.Z_throttle = -(input.thr_stick+1.0)/2.0;
             break;
 
         case TEST_BENCH_6DOF:
@@ -155,12 +164,12 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.X_throttle = -user_input.pitch_stick;
-            setpoint.Y_throttle = user_input.roll_stick;
+            setpoint.X_throttle = -input.pitch_stick;
+            setpoint.Y_throttle = input.roll_stick;
             setpoint.roll_throttle = 0.0;
             setpoint.pitch_throttle = 0.0;
-            setpoint.yaw_throttle = user_input.yaw_stick;
-            setpoint.Z_throttle = -user_input.thr_stick;
+            setpoint.yaw_throttle = input.yaw_stick;
+            setpoint.Z_throttle = -input.thr_stick;
             break;
 
         case DIRECT_THROTTLE_4DOF:
@@ -170,9 +179,9 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.roll = user_input.roll_stick;
-            setpoint.pitch = user_input.pitch_stick;
-            setpoint.Z_throttle = -user_input.thr_stick;
+            setpoint.roll = input.roll_stick;
+            setpoint.pitch = input.pitch_stick;
+            setpoint.Z_throttle = -input.thr_stick;
             __update_yaw();
             break;
 
@@ -183,9 +192,9 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.X_throttle = -user_input.pitch_stick;
-            setpoint.Y_throttle = user_input.roll_stick;
-            setpoint.Z_throttle = -user_input.thr_stick;
+            setpoint.X_throttle = -input.pitch_stick;
+            setpoint.Y_throttle = input.roll_stick;
+            setpoint.Z_throttle = -input.thr_stick;
             __update_yaw();
             break;
 
@@ -196,8 +205,8 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.roll = user_input.roll_stick;
-            setpoint.pitch = user_input.pitch_stick;
+            setpoint.roll = input.roll_stick;
+            setpoint.pitch = input.pitch_stick;
             __update_Z();
             __update_yaw();
             break;
@@ -211,8 +220,8 @@ int setpoint_manager_update(void)
 
             setpoint.roll = 0.0;
             setpoint.pitch = 0.0;
-            setpoint.X_throttle = -user_input.pitch_stick;
-            setpoint.Y_throttle = user_input.roll_stick;
+            setpoint.X_throttle = -input.pitch_stick;
+            setpoint.Y_throttle = input.roll_stick;
             __update_Z();
             __update_yaw();
             break;
@@ -224,8 +233,8 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 1;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.X_dot = -user_input.pitch_stick * settings.max_XY_velocity;
-            setpoint.Y_dot = user_input.roll_stick * settings.max_XY_velocity;
+            setpoint.X_dot = -input.pitch_stick * settings.max_XY_velocity;
+            setpoint.Y_dot = input.roll_stick * settings.max_XY_velocity;
             __update_Z();
             __update_yaw();
             break;
@@ -237,8 +246,10 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 1;
             setpoint.en_XY_pos_ctrl = 0;
 
-            setpoint.X_dot = -user_input.pitch_stick * settings.max_XY_velocity;
-            setpoint.Y_dot = user_input.roll_stick * settings.max_XY_velocity;
+            setpoint.roll = 0.0;
+            setpoint.pitch = 0.0;
+            setpoint.X_dot = -input.pitch_stick * settings.max_XY_velocity;
+            setpoint.Y_dot = input.roll_stick * settings.max_XY_velocity;
             __update_Z();
             __update_yaw();
             break;
@@ -250,8 +261,8 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 1;
 
-            setpoint.X_dot = -user_input.pitch_stick * settings.max_XY_velocity;
-            setpoint.Y_dot = user_input.roll_stick * settings.max_XY_velocity;
+            setpoint.X_dot = -input.pitch_stick * settings.max_XY_velocity;
+            setpoint.Y_dot = input.roll_stick * settings.max_XY_velocity;
             __update_XY_pos();
             __update_Z();
             __update_yaw();
@@ -264,8 +275,10 @@ int setpoint_manager_update(void)
             setpoint.en_XY_vel_ctrl = 0;
             setpoint.en_XY_pos_ctrl = 1;
 
-            setpoint.X_dot = -user_input.pitch_stick * settings.max_XY_velocity;
-            setpoint.Y_dot = user_input.roll_stick * settings.max_XY_velocity;
+            setpoint.roll = 0.0;
+            setpoint.pitch = 0.0;
+            setpoint.X_dot = -input.pitch_stick * settings.max_XY_velocity;
+            setpoint.Y_dot = input.roll_stick * settings.max_XY_velocity;
             __update_XY_pos();
             __update_Z();
             __update_yaw();
@@ -275,10 +288,10 @@ int setpoint_manager_update(void)
             fprintf(stderr, "ERROR in setpoint_manager thread, unknown flight mode\n");
             break;
 
-    }  // end switch(user_input.flight_mode)
+    }  // end switch(input.flight_mode)
 
     // arm feedback when requested
-    if (user_input.requested_arm_mode == ARMED)
+    if (input.requested_arm_mode == ARMED)
     {
         if (fstate.arm_state == DISARMED) feedback_arm();
     }
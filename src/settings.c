@@ -129,13 +129,13 @@ static int was_load_successful = 0;
     strcpy(settings.name, json_object_get_string(tmp));
 
 // macro for reading feedback controller
-#define PARSE_CONTROLLER(name)                                             \
+#define PARSE_CONTROLLER(name, dt)                                         \
     if (json_object_object_get_ex(jobj, #name, &tmp) == 0)                 \
     {                                                                      \
         fprintf(stderr, "ERROR: can't find " #name " in settings file\n"); \
         return -1;                                                         \
     }                                                                      \
-    if (__parse_controller(tmp, &settings.name))                           \
+    if (__parse_controller(tmp, &settings.name, dt))                       \
     {                                                                      \
         fprintf(stderr, "ERROR: could not parse " #name "\n");             \
         return -1;                                                         \
@@ -198,6 +198,51 @@ static int __parse_layout(void)
     return 0;
 }
 
+/**
+ * @brief      parses a custom thrust map, an array of [signal, thrust] pairs.
+ *             The values themselves are checked by thrust_map_init_custom.
+ *
+ * @param      array  The json array
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __parse_thrust_map_table(json_object* array)
+{
+    struct json_object* row = NULL;
+    struct json_object* tmp = NULL;
+    int i, j, len;
+
+    len = json_object_array_length(array);
+    if (len < 2 || len > THRUST_MAP_MAX_POINTS)
+    {
+        fprintf(stderr, "ERROR: custom thrust_map needs 2 to %d rows\n", THRUST_MAP_MAX_POINTS);
+        return -1;
+    }
+    for (i = 0; i < len; i++)
+    {
+        row = json_object_array_get_idx(array, i);
+        if (json_object_is_type(row, json_type_array) == 0 || json_object_array_length(row) != 2)
+        {
+            fprintf(stderr, "ERROR: custom thrust_map rows should be [signal, thrust]\n");
+            return -1;
+        }
+        for (j = 0; j < 2; j++)
+        {
+            tmp = json_object_array_get_idx(row, j);
+            if (json_object_is_type(tmp, json_type_double) == 0 &&
+                json_object_is_type(tmp, json_type_int) == 0)
+            {
+                fprintf(stderr, "ERROR: custom thrust_map entries should be numbers\n");
+                return -1;
+            }
+            settings.thrust_map_custom[i][j] = json_object_get_double(tmp);
+        }
+    }
+    settings.thrust_map_custom_points = len;
+    settings.thrust_map = CUSTOM_MAP;
+    return 0;
+}
+
 static int __parse_thrust_map(void)
 {
     struct json_object* tmp = NULL;
@@ -207,9 +252,14 @@ static int __parse_thrust_map(void)
         fprintf(stderr, "ERROR: can't find thrust_map in settings file\n");
         return -1;
     }
+    // a table of {signal, thrust} rows instead of a name
+    if (json_object_is_type(tmp, json_type_array))
+    {
+        return __parse_thrust_map_table(tmp);
+    }
     if (json_object_is_type(tmp, json_type_string) == 0)
     {
-        fprintf(stderr, "ERROR: thrust map should be a string\n");
+        fprintf(stderr, "ERROR: thrust map should be a string or an array\n");
         return -1;
     }
     tmp_str = (char*)json_object_get_string(tmp);
@@ -339,10 +389,11 @@ static int __parse_kill_mode(void)
  *
  * @param      jobj         The jobj to parse
  * @param      filter       pointer to write the new filter to
+ * @param      dt           timestep the controller will be marched at
  *
  * @return     0 on success, -1 on failure
  */
-static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
+static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter, double dt)
 {
     struct json_object* array = NULL;  // to hold num & den arrays
     struct json_object* tmp = NULL;    // temp object
@@ -480,7 +531,7 @@ static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
                 return -1;
             }
             tmp_flt = json_object_get_double(tmp);
-            if (rc_filter_c2d_tustin(filter, DT, num_vec, den_vec, tmp_flt))
+            if (rc_filter_c2d_tustin(filter, dt, num_vec, den_vec, tmp_flt))
             {
                 fprintf(stderr, "ERROR: failed to c2dtustin while parsing json\n");
                 return -1;
@@ -490,7 +541,7 @@ static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
         // if DT, much easier, just construct filter
         else if (strcmp(tmp_str, "DT") == 0)
         {
-            if (rc_filter_alloc(filter, num_vec, den_vec, DT))
+            if (rc_filter_alloc(filter, num_vec, den_vec, dt))
             {
                 fprintf(stderr, "ERROR: failed to alloc filter in __parse_controller()");
                 return -1;
@@ -539,7 +590,7 @@ static int __parse_controller(json_object* jobj_ctl, rc_filter_t* filter)
             return -1;
         }
         tmp_flt = json_object_get_double(tmp);
-        if (rc_filter_pid(filter, tmp_kp, tmp_ki, tmp_kd, 1.0 / tmp_flt, DT))
+        if (rc_filter_pid(filter, tmp_kp, tmp_ki, tmp_kd, 1.0 / tmp_flt, dt))
         {
             fprintf(stderr, "ERROR: failed to alloc pid filter in __parse_controller()");
             return -1;
@@ -604,6 +655,18 @@ int settings_load_from_file(char* path)
     fprintf(stderr, "warnings: %d\n", settings.warnings_en);
 #endif
 
+    // LOOP RATE, needed before anything is discretized
+    PARSE_INT_MIN_MAX(feedback_hz, 4, MAX_FEEDBACK_HZ)
+    if (MAX_FEEDBACK_HZ % settings.feedback_hz != 0)
+    {
+        fprintf(stderr, "ERROR parsing settings file, feedback_hz must divide %d\n",
+            MAX_FEEDBACK_HZ);
+        return -1;
+    }
+    settings.dt = 1.0 / settings.feedback_hz;
+    PARSE_BOOL(enable_rt_hardening)
+    PARSE_BOOL(enable_degradation)
+
     // PHYSICAL PARAMETERS
     // layout populates num_rotors, layout, and dof
     if (__parse_layout() == -1) return -1;  // parse_layout also fill in num_rotors and dof
@@ -614,10 +677,12 @@ int settings_load_from_file(char* path)
 #ifdef DEBUG
     fprintf(stderr, "thrust_map: %d\n", settings.thrust_map);
 #endif
+    PARSE_INT_MIN_MAX(thrust_map_lut_len, 1, 100000)
     PARSE_DOUBLE_MIN_MAX(v_nominal, 7.0, 18.0)
 #ifdef DEBUG
     fprintf(stderr, "v_nominal: %f\n", settings.v_nominal);
 #endif
+    PARSE_INT_MIN_MAX(battery_sample_hz, 20, 50)
     PARSE_BOOL(enable_magnetometer)
 
     // FLIGHT MODES
@@ -677,6 +742,7 @@ int settings_load_from_file(char* path)
     PARSE_BOOL(printf_u)
     PARSE_BOOL(printf_motors)
     PARSE_BOOL(printf_mode)
+    PARSE_BOOL(printf_timing)
 
     // LOGGING
     PARSE_BOOL(enable_logging)
@@ -685,6 +751,21 @@ int settings_load_from_file(char* path)
     PARSE_BOOL(log_setpoint)
     PARSE_BOOL(log_control_u)
     PARSE_BOOL(log_motor_signals)
+    PARSE_INT_MIN_MAX(log_buffer_len, 64, 65536)
+    PARSE_INT_MIN_MAX(log_segment_seconds, 10, 3600)
+    PARSE_INT_MIN_MAX(log_keyframe_interval, 1, 65536)
+    PARSE_INT_MIN_MAX(log_max_files, 0, 100000)
+    PARSE_INT_MIN_MAX(log_max_mb, 0, 1000000)
+    PARSE_DOUBLE_MIN_MAX(log_resolution_sensors, 0, 1)
+    PARSE_DOUBLE_MIN_MAX(log_resolution_state, 0, 1)
+    PARSE_DOUBLE_MIN_MAX(log_resolution_setpoint, 0, 1)
+    PARSE_DOUBLE_MIN_MAX(log_resolution_control_u, 0, 1)
+    PARSE_DOUBLE_MIN_MAX(log_resolution_motor_signals, 0, 1)
+
+    // BLACKBOX
+    PARSE_BOOL(enable_blackbox)
+    PARSE_INT_MIN_MAX(blackbox_seconds, 1, 120)
+    PARSE_INT_MIN_MAX(blackbox_max_files, 0, 100000)
 
     // MAVLINK
     PARSE_STRING(dest_ip)
@@ -692,14 +773,16 @@ int settings_load_from_file(char* path)
     PARSE_INT(mav_port)
 
     // FEEDBACK CONTROLLERS
-    PARSE_CONTROLLER(roll_controller)
-    PARSE_CONTROLLER(pitch_controller)
-    PARSE_CONTROLLER(yaw_controller)
-    PARSE_CONTROLLER(altitude_controller)
-    PARSE_CONTROLLER(horiz_vel_ctrl_4dof)
-    PARSE_CONTROLLER(horiz_vel_ctrl_6dof)
-    PARSE_CONTROLLER(horiz_pos_ctrl_4dof)
-    PARSE_CONTROLLER(horiz_pos_ctrl_6dof)
+    PARSE_CONTROLLER(roll_controller, settings.dt)
+    PARSE_CONTROLLER(pitch_controller, settings.dt)
+    PARSE_CONTROLLER(yaw_controller, settings.dt)
+    PARSE_CONTROLLER(altitude_controller, settings.dt)
+    // horizontal controllers are marched at the decimated outer loop rate
+    PARSE_INT_MIN_MAX(horiz_ctrl_divisor, 1, settings.feedback_hz)
+    PARSE_CONTROLLER(horiz_vel_ctrl_4dof, settings.dt * settings.horiz_ctrl_divisor)
+    PARSE_CONTROLLER(horiz_vel_ctrl_6dof, settings.dt * settings.horiz_ctrl_divisor)
+    PARSE_CONTROLLER(horiz_pos_ctrl_4dof, settings.dt * settings.horiz_ctrl_divisor)
+    PARSE_CONTROLLER(horiz_pos_ctrl_6dof, settings.dt * settings.horiz_ctrl_divisor)
     PARSE_DOUBLE_MIN_MAX(max_XY_velocity, .1, 10)
     PARSE_DOUBLE_MIN_MAX(max_Z_velocity, .1, 10)
 
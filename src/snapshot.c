@@ -0,0 +1,37 @@
+/**
+ * @file snapshot.c
+ */
+
+#include <stdatomic.h>
+
+#include <seqlock.h>
+#include <snapshot.h>
+
+#define READ_TRIES 4  // readers are all lower priority, one retry nearly always does
+
+static snapshot_t latest;
+static seqlock_t latest_lock = SEQLOCK_INITIALIZER;
+static atomic_int published;
+
+void snapshot_publish(void)
+{
+    // only the IMU interrupt writes latest so it can read it without the lock
+    seqlock_write_begin(&latest_lock);
+    if (atomic_load_explicit(&published, memory_order_relaxed)) latest.tick++;
+    latest.state = state_estimate;
+    latest.setpoint = setpoint;
+    latest.fstate = fstate;
+    latest.deadline = deadline;
+    seqlock_write_end(&latest_lock);
+    atomic_store_explicit(&published, 1, memory_order_release);
+}
+
+int snapshot_get(snapshot_t* s)
+{
+    snapshot_t tmp;
+
+    if (!atomic_load_explicit(&published, memory_order_acquire)) return -1;
+    if (seqlock_read(&latest_lock, &tmp, &latest, sizeof(tmp), READ_TRIES)) return -1;
+    *s = tmp;
+    return 0;
+}
@@ -4,78 +4,89 @@
  */
 
 #include <math.h>
-#include <rc/adc.h>
-#include <rc/bmp.h>
 #include <rc/led.h>
 #include <rc/math/filter.h>
-#include <rc/math/kalman.h>
-#include <rc/math/matrix.h>
 #include <rc/math/other.h>
 #include <rc/math/quaternion.h>
 #include <rc/mpu.h>
 #include <rc/start_stop.h>
 #include <rc/time.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <baro_manager.h>
+#include <battery_manager.h>
+#include <blackbox.h>
+#include <deadline.h>
+#include <feedback.h>
 #include <rc_pilot_defs.h>
+#include <scheduler.h>
 #include <settings.h>
 #include <state_estimator.h>
 
 #define TWO_PI (M_PI * 2.0)
 
+// rates of the jobs that don't need to run every IMU sample
+#define MAG_HZ 50
+#define EULER_HZ 50  // continuous yaw tracking needs yaw rates below pi*EULER_HZ
+#define MOCAP_CHECK_HZ 50
+
 state_estimate_t state_estimate;  // extern variable in state_estimator.h
 
 // sensor data structs
 rc_mpu_data_t mpu_data;
-static rc_bmp_data_t bmp_data;
+static baro_sample_t baro;
 
-// battery filter
-static rc_filter_t batt_lp = RC_FILTER_INITIALIZER;
+/**
+ * Altitude kalman filter, states are altitude, climb rate and accelerometer
+ * bias. Fixed size so stepping it in the IMU interrupt never allocates, which
+ * rc_kalman_update_lin does on every step. The barometer only measures the
+ * first state so H is left out.
+ */
+typedef struct alt_kf_t
+{
+    double F[3][3];
+    double G[3];
+    double Q[3][3];
+    double R;
+    double P[3][3];
+    double x_est[3];
+    uint64_t step;
+} alt_kf_t;
 
 // altitude filter components
-static rc_kalman_t alt_kf = RC_KALMAN_INITIALIZER;
+static alt_kf_t alt_kf;
 static rc_filter_t acc_lp = RC_FILTER_INITIALIZER;
 
-static void __batt_init(void)
-{
-    // init the battery low pass filter
-    rc_filter_moving_average(&batt_lp, 20, DT);
-    double tmp = rc_adc_dc_jack();
-    if (tmp < 3.0)
-    {
-        tmp = settings.v_nominal;
-        if (settings.warnings_en)
-        {
-            fprintf(stderr, "WARNING: ADC read %0.1fV on the barrel jack. Please connect\n");
-            fprintf(stderr, "battery to barrel jack, assuming nominal voltage for now.\n");
-        }
-    }
-    rc_filter_prefill_inputs(&batt_lp, tmp);
-    rc_filter_prefill_outputs(&batt_lp, tmp);
-    return;
-}
+// counted in the IMU interrupt, printed by state_estimator_print_events
+static atomic_uint mocap_lost_events;
+static unsigned int printed_mocap_lost;
 
 static void __batt_march(void)
 {
-    double tmp = rc_adc_dc_jack();
-    if (tmp < 3.0) tmp = settings.v_nominal;
-    state_estimate.v_batt_raw = tmp;
-    state_estimate.v_batt_lp = rc_filter_march(&batt_lp, tmp);
-    return;
+    battery_sample_t batt;
+
+    // battery_manager filters in its own thread, just pick up the result. If
+    // it's busy publishing, last loop's values are still good.
+    if (battery_manager_get_latest(&batt)) return;
+    state_estimate.v_batt_raw = batt.v_raw;
+    state_estimate.v_batt_lp = batt.v_lp;
+    state_estimate.v_batt_comp = batt.comp;
+    state_estimate.batt_sag = batt.sag;
 }
 
-static void __batt_cleanup(void)
+/**
+ * @brief      Yaw of a NED quaternion, same as the third Tait-Bryan angle from
+ *             rc_quaternion_to_tb_array without working out the other two
+ */
+static double __quat_yaw(const double q[4])
 {
-    rc_filter_free(&batt_lp);
-    return;
+    return atan2(2.0 * (q[0] * q[3] + q[1] * q[2]), 1.0 - 2.0 * (q[2] * q[2] + q[3] * q[3]));
 }
 
 static void __imu_march(void)
 {
-    static double last_yaw = 0.0;
-    static int num_yaw_spins = 0;
-    double diff;
-
     // gyro and accel require converting to NED coordinates
     state_estimate.gyro[0] = mpu_data.gyro[1];
     state_estimate.gyro[1] = mpu_data.gyro[0];
@@ -90,8 +101,24 @@ static void __imu_march(void)
     state_estimate.quat_imu[2] = mpu_data.dmp_quat[1];   // Y (j)
     state_estimate.quat_imu[3] = -mpu_data.dmp_quat[3];  // Z (k)
 
-    // normalize it just in case
+    // normalize it just in case, feedback works from the quaternion directly
     rc_quaternion_norm_array(state_estimate.quat_imu);
+    return;
+}
+
+/**
+ * @brief      Rate group task converting the IMU quaternion to Tait-Bryan
+ *             angles for the log, printf, arming checks and the landed yaw
+ *             setpoint. Nothing in the control loop needs them every sample.
+ *
+ * @return     0
+ */
+static int __euler_march(void)
+{
+    static double last_yaw = 0.0;
+    static int num_yaw_spins = 0;
+    double diff;
+
     // generate tait bryan angles
     rc_quaternion_to_tb_array(state_estimate.quat_imu, state_estimate.tb_imu);
 
@@ -107,16 +134,16 @@ static void __imu_march(void)
     // finally the new value can be written
     state_estimate.imu_continuous_yaw = state_estimate.tb_imu[2] + (num_yaw_spins * TWO_PI);
     last_yaw = state_estimate.imu_continuous_yaw;
-    return;
+    return 0;
 }
 
-static void __mag_march(void)
+static int __mag_march(void)
 {
     static double last_yaw = 0.0;
     static int num_yaw_spins = 0;
 
-    // don't do anything if mag isn't enabled
-    if (!settings.enable_magnetometer) return;
+    // shed while the IMU interrupt is overrunning, heading holds its last value
+    if (deadline.level >= DEGRADE_SKIP_MAG) return 0;
 
     // mag require converting to NED coordinates
     state_estimate.mag[0] = mpu_data.mag[1];
@@ -131,16 +158,14 @@ static void __mag_march(void)
 
     // normalize it just in case
     rc_quaternion_norm_array(state_estimate.quat_mag);
-    // generate tait bryan angles
-    rc_quaternion_to_tb_array(state_estimate.quat_mag, state_estimate.tb_mag);
 
-    // heading
+    // heading, only the yaw of the fused quaternion is used
     state_estimate.mag_heading_raw = mpu_data.compass_heading_raw;
-    state_estimate.mag_heading = state_estimate.tb_mag[2];
+    state_estimate.mag_heading = __quat_yaw(state_estimate.quat_mag);
 
     // yaw is more annoying since we have to detect spins
     // also make sign negative since NED coordinates has Z point down
-    double diff = state_estimate.tb_mag[2] + (num_yaw_spins * TWO_PI) - last_yaw;
+    double diff = state_estimate.mag_heading + (num_yaw_spins * TWO_PI) - last_yaw;
     // detect the crossover point at +-PI and update num yaw spins
     if (diff < -M_PI)
         num_yaw_spins++;
@@ -148,9 +173,9 @@ static void __mag_march(void)
         num_yaw_spins--;
 
     // finally the new value can be written
-    state_estimate.mag_heading_continuous = state_estimate.tb_mag[2] + (num_yaw_spins * TWO_PI);
+    state_estimate.mag_heading_continuous = state_estimate.mag_heading + (num_yaw_spins * TWO_PI);
     last_yaw = state_estimate.mag_heading_continuous;
-    return;
+    return 0;
 }
 
 /**
@@ -160,91 +185,134 @@ static void __mag_march(void)
  */
 static int __altitude_init(void)
 {
-    // initialize altitude kalman filter and bmp sensor
-    rc_matrix_t F = RC_MATRIX_INITIALIZER;
-    rc_matrix_t G = RC_MATRIX_INITIALIZER;
-    rc_matrix_t H = RC_MATRIX_INITIALIZER;
-    rc_matrix_t Q = RC_MATRIX_INITIALIZER;
-    rc_matrix_t R = RC_MATRIX_INITIALIZER;
-    rc_matrix_t Pi = RC_MATRIX_INITIALIZER;
-
-    const int Nx = 3;
-    const int Ny = 1;
-    const int Nu = 1;
-
-    // allocate appropirate memory for system
-    rc_matrix_zeros(&F, Nx, Nx);
-    rc_matrix_zeros(&G, Nx, Nu);
-    rc_matrix_zeros(&H, Ny, Nx);
-    rc_matrix_zeros(&Q, Nx, Nx);
-    rc_matrix_zeros(&R, Ny, Ny);
-    rc_matrix_zeros(&Pi, Nx, Nx);
-
-    // define system -DT; // accel bias
-    F.d[0][0] = 1.0;
-    F.d[0][1] = DT;
-    F.d[0][2] = 0.0;
-    F.d[1][0] = 0.0;
-    F.d[1][1] = 1.0;
-    F.d[1][2] = -DT;  // subtract accel bias
-    F.d[2][0] = 0.0;
-    F.d[2][1] = 0.0;
-    F.d[2][2] = 1.0;  // accel bias state
-
-    G.d[0][0] = 0.5 * DT * DT;
-    G.d[0][1] = DT;
-    G.d[0][2] = 0.0;
-
-    H.d[0][0] = 1.0;
-    H.d[0][1] = 0.0;
-    H.d[0][2] = 0.0;
+    // define system
+    alt_kf.F[0][0] = 1.0;
+    alt_kf.F[0][1] = settings.dt;
+    alt_kf.F[0][2] = 0.0;
+    alt_kf.F[1][0] = 0.0;
+    alt_kf.F[1][1] = 1.0;
+    alt_kf.F[1][2] = -settings.dt;  // subtract accel bias
+    alt_kf.F[2][0] = 0.0;
+    alt_kf.F[2][1] = 0.0;
+    alt_kf.F[2][2] = 1.0;  // accel bias state
+
+    alt_kf.G[0] = 0.5 * settings.dt * settings.dt;
+    alt_kf.G[1] = settings.dt;
+    alt_kf.G[2] = 0.0;
 
     // covariance matrices
-    Q.d[0][0] = 0.000000001;
-    Q.d[1][1] = 0.000000001;
-    Q.d[2][2] = 0.0001;  // don't want bias to change too quickly
-    R.d[0][0] = 1000000.0;
+    memset(alt_kf.Q, 0, sizeof(alt_kf.Q));
+    alt_kf.Q[0][0] = 0.000000001;
+    alt_kf.Q[1][1] = 0.000000001;
+    alt_kf.Q[2][2] = 0.0001;  // don't want bias to change too quickly
+    alt_kf.R = 1000000.0;
 
     // initial P, cloned from converged P while running
-    Pi.d[0][0] = 1258.69;
-    Pi.d[0][1] = 158.6114;
-    Pi.d[0][2] = -9.9937;
-    Pi.d[1][0] = 158.6114;
-    Pi.d[1][1] = 29.9870;
-    Pi.d[1][2] = -2.5191;
-    Pi.d[2][0] = -9.9937;
-    Pi.d[2][1] = -2.5191;
-    Pi.d[2][2] = 0.3174;
-
-    // initialize the kalman filter
-    if (rc_kalman_alloc_lin(&alt_kf, F, G, H, Q, R, Pi) == -1) return -1;
-    rc_matrix_free(&F);
-    rc_matrix_free(&G);
-    rc_matrix_free(&H);
-    rc_matrix_free(&Q);
-    rc_matrix_free(&R);
-    rc_matrix_free(&Pi);
+    alt_kf.P[0][0] = 1258.69;
+    alt_kf.P[0][1] = 158.6114;
+    alt_kf.P[0][2] = -9.9937;
+    alt_kf.P[1][0] = 158.6114;
+    alt_kf.P[1][1] = 29.9870;
+    alt_kf.P[1][2] = -2.5191;
+    alt_kf.P[2][0] = -9.9937;
+    alt_kf.P[2][1] = -2.5191;
+    alt_kf.P[2][2] = 0.3174;
+
+    memset(alt_kf.x_est, 0, sizeof(alt_kf.x_est));
+    alt_kf.step = 0;
 
     // initialize the little LP filter to take out accel noise
-    if (rc_filter_first_order_lowpass(&acc_lp, DT, 20 * DT)) return -1;
+    if (rc_filter_first_order_lowpass(&acc_lp, settings.dt, 0.1)) return -1;
 
-    // init barometer and read in first data
-    if (rc_bmp_read(&bmp_data)) return -1;
+    // baro_manager has taken the first reading already
+    if (baro_manager_get_latest(&baro)) return -1;
 
     return 0;
 }
 
+/**
+ * @brief      Symmetrize the altitude filter covariance to keep rounding from
+ *             building up
+ */
+static void __alt_kf_symmetrize(void)
+{
+    int i, j;
+    for (i = 0; i < 3; i++)
+    {
+        for (j = i + 1; j < 3; j++)
+        {
+            alt_kf.P[i][j] = alt_kf.P[j][i] = 0.5 * (alt_kf.P[i][j] + alt_kf.P[j][i]);
+        }
+    }
+}
+
+/**
+ * @brief      One predict and correct step of the altitude filter, same
+ *             sequence as rc_kalman_update_lin with H = [1 0 0]
+ *
+ * @param[in]  u     vertical acceleration, positive up
+ * @param[in]  y     barometer altitude, negated to match the states
+ */
+static void __alt_kf_update(double u, double y)
+{
+    int i, j, k;
+    double x_pre[3], FP[3][3], L[3], P0[3], S, z;
+
+    // x_pre = F*x_est + G*u
+    for (i = 0; i < 3; i++)
+    {
+        x_pre[i] = alt_kf.G[i] * u;
+        for (j = 0; j < 3; j++) x_pre[i] += alt_kf.F[i][j] * alt_kf.x_est[j];
+    }
+
+    // P = F*P*F^T + Q
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            FP[i][j] = 0.0;
+            for (k = 0; k < 3; k++) FP[i][j] += alt_kf.F[i][k] * alt_kf.P[k][j];
+        }
+    }
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            alt_kf.P[i][j] = alt_kf.Q[i][j];
+            for (k = 0; k < 3; k++) alt_kf.P[i][j] += FP[i][k] * alt_kf.F[j][k];
+        }
+    }
+    __alt_kf_symmetrize();
+
+    // S = H*P*H^T + R and L = P*H^T/S, H picks out the first state
+    S = alt_kf.P[0][0] + alt_kf.R;
+    for (i = 0; i < 3; i++) L[i] = alt_kf.P[i][0] / S;
+
+    // x_est = x_pre + L*(y - H*x_pre)
+    z = y - x_pre[0];
+    for (i = 0; i < 3; i++) alt_kf.x_est[i] = x_pre[i] + L[i] * z;
+
+    // P = P - L*H*P
+    for (j = 0; j < 3; j++) P0[j] = alt_kf.P[0][j];
+    for (i = 0; i < 3; i++)
+    {
+        for (j = 0; j < 3; j++) alt_kf.P[i][j] -= L[i] * P0[j];
+    }
+    __alt_kf_symmetrize();
+    alt_kf.step++;
+}
+
 static void __altitude_march(void)
 {
     int i;
     double accel_vec[3];
-    static rc_vector_t u = RC_VECTOR_INITIALIZER;
-    static rc_vector_t y = RC_VECTOR_INITIALIZER;
 
-    // grab raw data
-    state_estimate.bmp_pressure_raw = bmp_data.pressure_pa;
-    state_estimate.alt_bmp_raw = bmp_data.alt_m;
-    state_estimate.bmp_temp = bmp_data.temp_c;
+    // grab the latest barometer sample, if the sampler is busy publishing a
+    // new one just use the last one again
+    baro_manager_get_latest(&baro);
+    state_estimate.bmp_pressure_raw = baro.pressure_pa;
+    state_estimate.alt_bmp_raw = baro.alt_m;
+    state_estimate.bmp_temp = baro.temp_c;
 
     // make copy of acceleration reading before rotating
     for (i = 0; i < 3; i++) accel_vec[i] = state_estimate.accel[i];
@@ -255,34 +323,33 @@ static void __altitude_march(void)
     // do first-run filter setup
     if (alt_kf.step == 0)
     {
-        rc_vector_zeros(&u, 1);
-        rc_vector_zeros(&y, 1);
-        alt_kf.x_est.d[0] = -bmp_data.alt_m;
+        alt_kf.x_est[0] = -baro.alt_m;
         rc_filter_prefill_inputs(&acc_lp, accel_vec[2] + GRAVITY);
         rc_filter_prefill_outputs(&acc_lp, accel_vec[2] + GRAVITY);
     }
 
     // calculate acceleration and smooth it just a tad
-    // put result in u for kalman and flip sign since with altitude, positive
+    // use result as u for kalman and flip sign since with altitude, positive
     // is up whereas acceleration in Z points down.
     rc_filter_march(&acc_lp, accel_vec[2] + GRAVITY);
-    u.d[0] = acc_lp.newest_output;
 
     // don't bother filtering Barometer, kalman will deal with that
-    y.d[0] = -bmp_data.alt_m;
-
-    rc_kalman_update_lin(&alt_kf, u, y);
+    __alt_kf_update(acc_lp.newest_output, -baro.alt_m);
 
     // altitude estimate
-    state_estimate.alt_bmp = alt_kf.x_est.d[0];
-    state_estimate.alt_bmp_vel = alt_kf.x_est.d[1];
-    state_estimate.alt_bmp_accel = alt_kf.x_est.d[2];
+    state_estimate.alt_bmp = alt_kf.x_est[0];
+    state_estimate.alt_bmp_vel = alt_kf.x_est[1];
+    state_estimate.alt_bmp_accel = alt_kf.x_est[2];
 
     return;
 }
 
 static void __feedback_select(void)
 {
+    state_estimate.quat[0] = state_estimate.quat_imu[0];
+    state_estimate.quat[1] = state_estimate.quat_imu[1];
+    state_estimate.quat[2] = state_estimate.quat_imu[2];
+    state_estimate.quat[3] = state_estimate.quat_imu[3];
     state_estimate.roll = state_estimate.tb_imu[0];
     state_estimate.pitch = state_estimate.tb_imu[1];
     state_estimate.yaw = state_estimate.tb_imu[2];
@@ -294,12 +361,11 @@ static void __feedback_select(void)
 
 static void __altitude_cleanup(void)
 {
-    rc_kalman_free(&alt_kf);
     rc_filter_free(&acc_lp);
     return;
 }
 
-static void __mocap_check_timeout(void)
+static int __mocap_check_timeout(void)
 {
     if (state_estimate.mocap_running)
     {
@@ -308,19 +374,26 @@ static void __mocap_check_timeout(void)
         if ((current_time - state_estimate.mocap_timestamp_ns) > (3 * 1E7))
         {
             state_estimate.mocap_running = 0;
-            if (settings.warnings_en)
-            {
-                fprintf(stderr, "WARNING, MOCAP LOST VISUAL\n");
-            }
+            if (fstate.arm_state == ARMED) blackbox_trigger(BLACKBOX_SENSOR_FAULT);
+            atomic_fetch_add_explicit(&mocap_lost_events, 1, memory_order_relaxed);
         }
     }
-    return;
+    return 0;
 }
 
 int state_estimator_init(void)
 {
-    __batt_init();
+    __batt_march();
     if (__altitude_init()) return -1;
+
+    // slower jobs run from the rate groups after feedback_march
+    if (sched_add("euler", __euler_march, EULER_HZ, SCHED_AUTO_PHASE)) return -1;
+    if (settings.enable_magnetometer)
+    {
+        if (sched_add("magnetometer", __mag_march, MAG_HZ, SCHED_AUTO_PHASE)) return -1;
+    }
+    if (sched_add("mocap_timeout", __mocap_check_timeout, MOCAP_CHECK_HZ, SCHED_AUTO_PHASE))
+        return -1;
     state_estimate.initialized = 1;
     return 0;
 }
@@ -334,33 +407,25 @@ int state_estimator_march(void)
     }
 
     // populate state_estimate struct one setion at a time, top to bottom
+    // magnetometer and mocap timeout are in the rate groups, the barometer
+    // and battery are read by their own threads
     __batt_march();
     __imu_march();
-    __mag_march();
     __altitude_march();
     __feedback_select();
-    __mocap_check_timeout();
     return 0;
 }
 
-int state_estimator_jobs_after_feedback(void)
+void state_estimator_print_events(FILE* fp)
 {
-    static int bmp_sample_counter = 0;
+    unsigned int n = atomic_load_explicit(&mocap_lost_events, memory_order_relaxed);
 
-    // check if we need to sample BMP this loop
-    if (bmp_sample_counter >= BMP_RATE_DIV)
-    {
-        // perform the i2c reads to the sensor, on bad read just try later
-        if (rc_bmp_read(&bmp_data)) return -1;
-        bmp_sample_counter = 0;
-    }
-    bmp_sample_counter++;
-    return 0;
+    if (n != printed_mocap_lost) fprintf(fp, "WARNING, MOCAP LOST VISUAL\n");
+    printed_mocap_lost = n;
 }
 
 int state_estimator_cleanup(void)
 {
-    __batt_cleanup();
     __altitude_cleanup();
     return 0;
 }
\ No newline at end of file
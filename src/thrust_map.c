@@ -2,25 +2,40 @@
  * @file thrust_map.c
  *
  * Most ESC/motor/propeller combinations provide a highly non-linear map from
- * input to thrust. For the thrust table defined in thrust_map.h, this provides
- * the function to translate a desired normalized thrust (0-1) to the necessary
- * input (also 0-1).
+ * input to thrust. For the thrust tables defined below or one given in the
+ * settings file, this provides the function to translate a desired normalized
+ * thrust (0-1) to the necessary input (also 0-1).
  **/
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
 #include <thrust_map.h>
 
 static double* signal;
 static double* thrust;
+static double* slope;  // d(signal)/d(thrust) at each point for PCHIP, NULL if linear
 static int points;
 
+// the same curve resampled at lut_len+1 evenly spaced thrust values so a
+// lookup doesn't need to search for the segment, float copy for the f32 path
+static double* lut;
+static float* lut_f;
+static int lut_len;
+static double lut_err;
+
+#define LUT_CHECKS 8  // points checked inside each table interval for a smooth curve
+
 // clang-format off
 
 // Generic linear mapping
 static const int linear_map_points = 11;
-static double linear_map[][2] = {
+static const double linear_map[][2] = {
     {0.0, 0.0000}, 
     {0.1, 0.1000}, 
     {0.2, 0.2000}, 
@@ -37,7 +52,7 @@ static double linear_map[][2] = {
 // BLheli ESC Low Timing
 // this one is in Newtons but it doesn't really matter
 static const int mn1806_1400kv_4s_points = 11;
-static double mn1806_1400kv_4s_map[][2] = {
+static const double mn1806_1400kv_4s_map[][2] = {
     {0.0, 0.0000}, 
     {0.1, 0.2982}, 
     {0.2, 0.6310},
@@ -54,7 +69,7 @@ static double mn1806_1400kv_4s_map[][2] = {
 // blheli esc med-low timing
 // thrust units in gram-force but doesn't really matter
 static const int f20_2300kv_2s_points = 21;
-static double f20_2300kv_2s_map[][2] = {
+static const double f20_2300kv_2s_map[][2] = {
     {0.00, 0.000000}, 
     {0.05, 6.892067}, 
     {0.10, 12.57954},
@@ -83,7 +98,7 @@ static double f20_2300kv_2s_map[][2] = {
  * for 5" monocoque hex
  */
 static const int rx2206_4s_points = 12;
-static double rx2206_4s_map[][2] = {
+static const double rx2206_4s_map[][2] = {
     {0.0, 0.00000000000000}, 
     {0.05, 17.8844719758775},
     {0.145, 44.8761484808831}, 
@@ -99,37 +114,70 @@ static double rx2206_4s_map[][2] = {
 
 // clang-format on
 
-int thrust_map_init(thrust_map_t map)
+/**
+ * @brief      Fritsch-Carlson slopes for a monotone cubic through the points,
+ *             as in scipy's PchipInterpolator.
+ */
+static void __pchip_slopes(void)
 {
     int i;
-    double max;
-    double(*data)[2];  // pointer to constant data
+    double h0, h1, d0, d1, w0, w1;
 
-    switch (map)
+    if (points == 2)
     {
-        case LINEAR_MAP:
-            points = linear_map_points;
-            data = linear_map;
-            break;
-        case MN1806_1400KV_4S:
-            points = mn1806_1400kv_4s_points;
-            data = mn1806_1400kv_4s_map;
-            break;
-        case F20_2300KV_2S:
-            points = f20_2300kv_2s_points;
-            data = f20_2300kv_2s_map;
-            break;
-        case RX2206_4S:
-            points = rx2206_4s_points;
-            data = rx2206_4s_map;
-            break;
-        default:
-            fprintf(stderr, "ERROR: unknown thrust map\n");
-            return -1;
+        slope[0] = slope[1] = (signal[1] - signal[0]) / (thrust[1] - thrust[0]);
+        return;
+    }
+
+    // interior points, weighted harmonic mean of the neighbouring secants
+    for (i = 1; i < points - 1; i++)
+    {
+        h0 = thrust[i] - thrust[i - 1];
+        h1 = thrust[i + 1] - thrust[i];
+        d0 = (signal[i] - signal[i - 1]) / h0;
+        d1 = (signal[i + 1] - signal[i]) / h1;
+        w0 = 2.0 * h1 + h0;
+        w1 = h1 + 2.0 * h0;
+        slope[i] = (w0 + w1) / (w0 / d0 + w1 / d1);
+    }
+
+    // one sided three point ends, limited to between 0 and 3x the secant so the
+    // end segments are always monotone
+    for (i = 0; i < 2; i++)
+    {
+        int a = i == 0 ? 0 : points - 1;
+        int b = i == 0 ? 1 : points - 2;
+        int c = i == 0 ? 2 : points - 3;
+        double s;
+        h0 = fabs(thrust[b] - thrust[a]);
+        h1 = fabs(thrust[c] - thrust[b]);
+        d0 = (signal[b] - signal[a]) / (thrust[b] - thrust[a]);
+        d1 = (signal[c] - signal[b]) / (thrust[c] - thrust[b]);
+        s = ((2.0 * h0 + h1) * d0 - h0 * d1) / (h0 + h1);
+        if (s < 0.0)
+            s = 0.0;
+        else if (s > 3.0 * d0)
+            s = 3.0 * d0;
+        slope[a] = s;
     }
+}
+
+/**
+ * @brief      Validate a table of {signal, thrust} rows and build everything
+ *             the lookups need from it.
+ */
+static int __init_data(const double (*data)[2], int n, int lut_points, int smooth)
+{
+    int i, j;
+    double err, max, x;
 
     // sanity checks
-    if (points < 2)
+    if (lut_points < 1)
+    {
+        fprintf(stderr, "ERROR: thrust map lookup table needs at least 1 interval\n");
+        return -1;
+    }
+    if (n < 2)
     {
         fprintf(stderr, "ERROR: need at least 2 datapoints in THRUST_MAP\n");
         return -1;
@@ -139,10 +187,10 @@ int thrust_map_init(thrust_map_t map)
         fprintf(stderr, "ERROR: first row input must be 0.0\n");
         return -1;
     }
-    if (data[points - 1][0] != 1.0)
+    if (data[n - 1][0] != 1.0)
     {
         fprintf(stderr, "ERROR: last row input must be 1.0\n");
-        printf("data: %f\n", data[points - 1][0]);
+        printf("data: %f\n", data[n - 1][0]);
         return -1;
     }
     if (data[0][1] != 0.0)
@@ -150,12 +198,12 @@ int thrust_map_init(thrust_map_t map)
         fprintf(stderr, "ERROR: first row thrust must be 0.0\n");
         return -1;
     }
-    if (data[points - 1][1] < 0.0)
+    if (data[n - 1][1] < 0.0)
     {
         fprintf(stderr, "ERROR: last row thrust must be > 0.0\n");
         return -1;
     }
-    for (i = 1; i < points; i++)
+    for (i = 1; i < n; i++)
     {
         if (data[i][0] <= data[i - 1][0] || data[i][1] <= data[i - 1][1])
         {
@@ -165,44 +213,193 @@ int thrust_map_init(thrust_map_t map)
     }
 
     // create new global array of normalized thrust and inputs
+    points = n;
     if (signal != NULL) free(signal);
     if (thrust != NULL) free(thrust);
+    if (slope != NULL) free(slope);
     signal = (double*)malloc(points * sizeof(double));
     thrust = (double*)malloc(points * sizeof(double));
+    slope = NULL;
     max = data[points - 1][1];
     for (i = 0; i < points; i++)
     {
         signal[i] = data[i][0];
         thrust[i] = data[i][1] / max;
     }
+    if (smooth)
+    {
+        slope = (double*)malloc(points * sizeof(double));
+        __pchip_slopes();
+    }
+
+    // resample, table entries are exact so for a linear curve the worst error
+    // of the lookup is at one of the original points, a smooth one is also
+    // checked in between
+    if (lut != NULL) free(lut);
+    if (lut_f != NULL) free(lut_f);
+    lut_len = lut_points;
+    lut = (double*)malloc((lut_len + 1) * sizeof(double));
+    lut_f = (float*)malloc((lut_len + 1) * sizeof(float));
+    for (i = 0; i <= lut_len; i++)
+    {
+        lut[i] = map_motor_signal_exact((double)i / lut_len);
+        lut_f[i] = (float)lut[i];
+    }
+    lut_err = 0.0;
+    for (i = 1; i < points - 1; i++)
+    {
+        err = fabs(map_motor_signal(thrust[i]) - signal[i]);
+        if (err > lut_err) lut_err = err;
+    }
+    for (i = 0; smooth && i < lut_len; i++)
+    {
+        for (j = 1; j < LUT_CHECKS; j++)
+        {
+            x = (i + (double)j / LUT_CHECKS) / lut_len;
+            err = fabs(map_motor_signal(x) - map_motor_signal_exact(x));
+            if (err > lut_err) lut_err = err;
+        }
+    }
     return 0;
 }
 
-double map_motor_signal(double m)
+int thrust_map_init(thrust_map_t map, int lut_points)
+{
+    switch (map)
+    {
+        case LINEAR_MAP:
+            return __init_data(linear_map, linear_map_points, lut_points, 0);
+        case MN1806_1400KV_4S:
+            return __init_data(mn1806_1400kv_4s_map, mn1806_1400kv_4s_points, lut_points, 0);
+        case F20_2300KV_2S:
+            return __init_data(f20_2300kv_2s_map, f20_2300kv_2s_points, lut_points, 0);
+        case RX2206_4S:
+            return __init_data(rx2206_4s_map, rx2206_4s_points, lut_points, 0);
+        case CUSTOM_MAP:
+            fprintf(stderr, "ERROR: use thrust_map_init_custom for a custom thrust map\n");
+            return -1;
+        default:
+            fprintf(stderr, "ERROR: unknown thrust map\n");
+            return -1;
+    }
+}
+
+int thrust_map_init_custom(const double (*data)[2], int n, int lut_points)
+{
+    return __init_data(data, n, lut_points, 1);
+}
+
+double thrust_map_lut_error(void)
+{
+    return lut_err;
+}
+
+double map_motor_signal_exact(double m)
 {
     int i;
-    double pos;
+    double h, t, t2, t3;
 
-    // sanity check
-    if (m > 1.0 || m < 0.0)
+    // return quickly for boundary conditions, this also catches NaN
+    if (!(m > 0.0)) return 0.0;
+    if (m >= 1.0) return 1.0;
+
+    // scan through the data to pick the upper and lower points to interpolate
+    for (i = 1; i < points - 1; i++)
     {
-        printf("ERROR: desired thrust t must be between 0.0 & 1.0\n");
-        return -1;
+        if (m <= thrust[i]) break;
     }
+    h = thrust[i] - thrust[i - 1];
+    t = (m - thrust[i - 1]) / h;
+    if (slope == NULL) return signal[i - 1] + (t * (signal[i] - signal[i - 1]));
 
-    // return quickly for boundary conditions
-    if (m == 0.0 || m == 1.0) return m;
+    // cubic Hermite between the two points
+    t2 = t * t;
+    t3 = t2 * t;
+    return (2.0 * t3 - 3.0 * t2 + 1.0) * signal[i - 1] + (t3 - 2.0 * t2 + t) * h * slope[i - 1] +
+           (-2.0 * t3 + 3.0 * t2) * signal[i] + (t3 - t2) * h * slope[i];
+}
 
-    // scan through the data to pick the upper and lower points to interpolate
-    for (i = 1; i < points; i++)
+double map_motor_signal(double m)
+{
+    int i;
+    double x;
+
+    if (!(m > 0.0)) return lut[0];
+    if (m >= 1.0) return lut[lut_len];
+
+    x = m * lut_len;
+    i = (int)x;
+    // only possible by rounding for m just under 1
+    if (i >= lut_len) i = lut_len - 1;
+    return lut[i] + (x - i) * (lut[i + 1] - lut[i]);
+}
+
+void map_motor_signals(const double* m, double* out, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) out[i] = map_motor_signal(m[i]);
+}
+
+void map_motor_signals_f32(const float* m, float* out, int n)
+{
+    int i;
+#ifdef __ARM_NEON
+    float in[8] __attribute__((aligned(16))) = {0.0f};
+    float frac[8] __attribute__((aligned(16)));
+    float lo[8] __attribute__((aligned(16)));
+    float hi[8] __attribute__((aligned(16)));
+    uint32_t idx[8] __attribute__((aligned(16)));
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t one = vdupq_n_f32(1.0f);
+    uint32x4_t top = vdupq_n_u32(lut_len - 1);
+    float32x4_t x0, x1;
+    uint32x4_t i0, i1;
+
+    if (n > 8) n = 8;
+    for (i = 0; i < n; i++) in[i] = m[i];
+
+    // clamp to [0,1] with NaN lanes to 0 like the scalar path, vmaxq_f32 would
+    // pass NaN through
+    x0 = vld1q_f32(in);
+    x1 = vld1q_f32(in + 4);
+    x0 = vminq_f32(vbslq_f32(vcgtq_f32(x0, zero), x0, zero), one);
+    x1 = vminq_f32(vbslq_f32(vcgtq_f32(x1, zero), x1, zero), one);
+
+    // index and fraction for all lanes, only the table reads are scalar
+    x0 = vmulq_n_f32(x0, (float)lut_len);
+    x1 = vmulq_n_f32(x1, (float)lut_len);
+    i0 = vminq_u32(vcvtq_u32_f32(x0), top);
+    i1 = vminq_u32(vcvtq_u32_f32(x1), top);
+    vst1q_f32(frac, vsubq_f32(x0, vcvtq_f32_u32(i0)));
+    vst1q_f32(frac + 4, vsubq_f32(x1, vcvtq_f32_u32(i1)));
+    vst1q_u32(idx, i0);
+    vst1q_u32(idx + 4, i1);
+    for (i = 0; i < 8; i++)
     {
-        if (m <= thrust[i])
-        {
-            pos = (m - thrust[i - 1]) / (thrust[i] - thrust[i - 1]);
-            return signal[i - 1] + (pos * (signal[i] - signal[i - 1]));
-        }
+        lo[i] = lut_f[idx[i]];
+        hi[i] = lut_f[idx[i] + 1];
     }
+    x0 = vmlaq_f32(vld1q_f32(lo), vsubq_f32(vld1q_f32(hi), vld1q_f32(lo)), vld1q_f32(frac));
+    x1 = vmlaq_f32(
+        vld1q_f32(lo + 4), vsubq_f32(vld1q_f32(hi + 4), vld1q_f32(lo + 4)), vld1q_f32(frac + 4));
+    vst1q_f32(lo, x0);
+    vst1q_f32(lo + 4, x1);
+    for (i = 0; i < n; i++) out[i] = lo[i];
+#else
+    int j;
+    float x;
 
-    fprintf(stderr, "ERROR: something in map_motor_signal went wrong\n");
-    return -1;
+    for (i = 0; i < n; i++)
+    {
+        x = m[i];
+        if (x > 1.0f)
+            x = 1.0f;
+        else if (!(x > 0.0f))
+            x = 0.0f;
+        x *= lut_len;
+        j = (int)x;
+        if (j >= lut_len) j = lut_len - 1;
+        out[i] = lut_f[j] + (x - j) * (lut_f[j + 1] - lut_f[j]);
+    }
+#endif
 }
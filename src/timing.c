@@ -0,0 +1,181 @@
+/**
+ * @file timing.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <rc/mpu.h>
+#include <rc/time.h>
+
+#include <rc_pilot_defs.h>
+#include <settings.h>
+#include <timing.h>
+
+#define SUB_BITS 4                   // 2^SUB_BITS buckets per power of two
+#define SUB_COUNT (1 << SUB_BITS)
+#define NUM_BUCKETS ((32 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef struct timing_hist_t
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[NUM_BUCKETS];
+} timing_hist_t;
+
+static const char* stage_names[TIMING_NUM_STAGES] = {
+    "wakeup", "setpoint", "estimator", "feedback", "log", "rate_groups", "total", "period",
+    "sens2motor"};
+
+static timing_hist_t hist[TIMING_NUM_STAGES];
+static uint64_t isr_start_ns;
+static uint64_t last_mark_ns;
+static uint64_t last_isr_start_ns;
+static timing_stage_t slowest_stage;  // longest stage marked in this callback
+static uint64_t slowest_ns;
+
+/**
+ * @brief      Histogram bucket for a value. Values below SUB_COUNT get their
+ *             own bucket, above that the top SUB_BITS+1 bits pick the bucket.
+ */
+static inline int __bucket(uint32_t v)
+{
+    int msb;
+    if (v < SUB_COUNT) return v;
+    msb = 31 - __builtin_clz(v);
+    return (msb - SUB_BITS + 1) * SUB_COUNT + (int)(v >> (msb - SUB_BITS)) - SUB_COUNT;
+}
+
+/**
+ * @brief      Largest value that lands in bucket i
+ */
+static uint32_t __bucket_top(int i)
+{
+    int shift;
+    if (i < SUB_COUNT) return i;
+    shift = i / SUB_COUNT - 1;
+    return (((uint64_t)(i % SUB_COUNT + SUB_COUNT) + 1) << shift) - 1;
+}
+
+static inline void __record(timing_stage_t stage, uint64_t ns)
+{
+    timing_hist_t* h = &hist[stage];
+    uint32_t v = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+
+    if (h->count == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->sum += v;
+    h->bucket[__bucket(v)]++;
+    h->count++;
+}
+
+void timing_isr_start(void)
+{
+    int64_t since_dmp;
+
+    isr_start_ns = rc_nanos_since_boot();
+    last_mark_ns = isr_start_ns;
+    slowest_stage = TIMING_TOTAL;
+    slowest_ns = 0;
+
+    since_dmp = rc_mpu_nanos_since_last_dmp_interrupt();
+    if (since_dmp >= 0) __record(TIMING_WAKEUP, since_dmp);
+    if (last_isr_start_ns != 0) __record(TIMING_PERIOD, isr_start_ns - last_isr_start_ns);
+    last_isr_start_ns = isr_start_ns;
+}
+
+void timing_mark(timing_stage_t stage)
+{
+    uint64_t now = rc_nanos_since_boot();
+    __record(stage, now - last_mark_ns);
+    if (now - last_mark_ns > slowest_ns)
+    {
+        slowest_ns = now - last_mark_ns;
+        slowest_stage = stage;
+    }
+    last_mark_ns = now;
+}
+
+void timing_record(timing_stage_t stage, uint64_t ns)
+{
+    if (stage < 0 || stage >= TIMING_NUM_STAGES) return;
+    __record(stage, ns);
+}
+
+timing_stage_t timing_slowest_stage(void)
+{
+    return slowest_stage;
+}
+
+uint64_t timing_isr_end(void)
+{
+    uint64_t total = rc_nanos_since_boot() - isr_start_ns;
+    __record(TIMING_TOTAL, total);
+    return total;
+}
+
+int timing_get_stats(timing_stage_t stage, timing_stats_t* s)
+{
+    int i;
+    uint64_t seen = 0;
+    uint64_t p50, p99, p999;
+    timing_hist_t* h;
+
+    if (stage < 0 || stage >= TIMING_NUM_STAGES) return -1;
+    h = &hist[stage];
+
+    memset(s, 0, sizeof(timing_stats_t));
+    s->count = h->count;
+    if (s->count == 0) return 0;
+    s->min_ns = h->min;
+    s->max_ns = h->max;
+    s->mean_ns = (double)h->sum / s->count;
+
+    // walk up the buckets until each percentile's rank is reached
+    p50 = (s->count * 500ULL + 999) / 1000;
+    p99 = (s->count * 990ULL + 999) / 1000;
+    p999 = (s->count * 999ULL + 999) / 1000;
+    for (i = 0; i < NUM_BUCKETS; i++)
+    {
+        if (h->bucket[i] == 0) continue;
+        seen += h->bucket[i];
+        if (s->p50_ns == 0 && seen >= p50) s->p50_ns = __bucket_top(i);
+        if (s->p99_ns == 0 && seen >= p99) s->p99_ns = __bucket_top(i);
+        if (s->p999_ns == 0 && seen >= p999)
+        {
+            s->p999_ns = __bucket_top(i);
+            break;
+        }
+    }
+
+    // the bucket edge can overshoot the real extreme
+    if (s->p50_ns > s->max_ns) s->p50_ns = s->max_ns;
+    if (s->p99_ns > s->max_ns) s->p99_ns = s->max_ns;
+    if (s->p999_ns > s->max_ns) s->p999_ns = s->max_ns;
+    return 0;
+}
+
+const char* timing_stage_name(timing_stage_t stage)
+{
+    if (stage < 0 || stage >= TIMING_NUM_STAGES) return "unknown";
+    return stage_names[stage];
+}
+
+void timing_print_report(FILE* fp)
+{
+    int i;
+    timing_stats_t s;
+
+    fprintf(fp, "\nIMU callback timing (us), nominal period %.1f\n", 1e6 / settings.feedback_hz);
+    fprintf(fp, "%-11s %9s %8s %8s %8s %8s %8s %8s\n", "stage", "count", "min", "mean", "p50",
+        "p99", "p99.9", "max");
+    for (i = 0; i < TIMING_NUM_STAGES; i++)
+    {
+        timing_get_stats(i, &s);
+        fprintf(fp, "%-11s %9u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", stage_names[i], s.count,
+            s.min_ns / 1e3, s.mean_ns / 1e3, s.p50_ns / 1e3, s.p99_ns / 1e3, s.p999_ns / 1e3,
+            s.max_ns / 1e3);
+    }
+}
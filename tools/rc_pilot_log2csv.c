@@ -0,0 +1,335 @@
+/**
+ * @file rc_pilot_log2csv.c
+ *
+ * Converts a binary log written by log_manager into the same csv layout that
+ * rc_pilot used to write directly. This does not depend on librobotcontrol so
+ * it can be built and run on a host computer after copying the logs off the
+ * vehicle.
+ *
+ * Compressed logs are expanded back to full entries here, the output is the
+ * same apart from values being rounded to the resolution set when flying.
+ *
+ * usage: rc_pilot_log2csv <log.bin> [out.csv]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+// to allow printf macros for multi-architecture portability
+#define __STDC_FORMAT_MACROS
+#include <inttypes.h>
+
+#include <log_format.h>
+
+static log_file_header_t header;
+static log_field_desc_t fields[LOG_MAX_FIELDS];
+
+// last decoded value of each field in a compressed log, raw integers for U64
+// fields and quantized values for doubles with a resolution
+static uint64_t prev_value[LOG_MAX_FIELDS];
+static int have_keyframe = 0;
+
+void print_usage(void)
+{
+    printf("\n");
+    printf(" Usage: rc_pilot_log2csv {log file} [csv file]\n");
+    printf("\n");
+    printf(" Converts a binary rc_pilot log to csv. If no csv file is given\n");
+    printf(" the result is written to stdout.\n");
+    printf("\n");
+}
+
+/**
+ * @brief      read and sanity check the file header and field descriptors
+ *
+ * @return     0 on success, -1 on failure
+ */
+static int __read_header(FILE* in)
+{
+    int i, len;
+
+    if (fread(&header, sizeof(header), 1, in) != 1)
+    {
+        fprintf(stderr, "ERROR: file too short to be an rc_pilot log\n");
+        return -1;
+    }
+    if (memcmp(header.magic, LOG_FILE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "ERROR: not an rc_pilot log file\n");
+        return -1;
+    }
+    if (header.version != LOG_FORMAT_VERSION)
+    {
+        fprintf(stderr, "ERROR: log format version %d, this tool reads version %d\n",
+            header.version, LOG_FORMAT_VERSION);
+        return -1;
+    }
+    if (header.num_fields > LOG_MAX_FIELDS)
+    {
+        fprintf(stderr, "ERROR: too many fields in log header\n");
+        return -1;
+    }
+    if (fread(fields, sizeof(log_field_desc_t), header.num_fields, in) != header.num_fields)
+    {
+        fprintf(stderr, "ERROR: failed to read field descriptors\n");
+        return -1;
+    }
+
+    // make sure the descriptors agree with the record length
+    len = 1;
+    for (i = 0; i < header.num_fields; i++)
+    {
+        fields[i].name[LOG_FIELD_NAME_LEN - 1] = 0;
+        fields[i].unit[LOG_FIELD_UNIT_LEN - 1] = 0;
+        if (!(fields[i].resolution >= 0.0))
+        {
+            fprintf(stderr, "ERROR: bad resolution for field %s\n", fields[i].name);
+            return -1;
+        }
+        if (fields[i].type == LOG_TYPE_U64)
+            len += sizeof(uint64_t);
+        else if (fields[i].type == LOG_TYPE_F64)
+            len += sizeof(double);
+        else
+        {
+            fprintf(stderr, "ERROR: unknown type for field %s\n", fields[i].name);
+            return -1;
+        }
+    }
+    if (len != header.record_len)
+    {
+        fprintf(stderr, "ERROR: record length in header doesn't match fields\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void __write_csv_header(FILE* out)
+{
+    int i;
+    for (i = 0; i < header.num_fields; i++)
+    {
+        fprintf(out, "%s%s", i ? "," : "", fields[i].name);
+    }
+    fprintf(out, "\n");
+}
+
+static void __write_csv_entry(FILE* out, const char* rec)
+{
+    int i;
+    uint64_t u;
+    double d;
+
+    for (i = 0; i < header.num_fields; i++)
+    {
+        if (i) fputc(',', out);
+        if (fields[i].type == LOG_TYPE_U64)
+        {
+            memcpy(&u, rec, sizeof(u));
+            rec += sizeof(u);
+            fprintf(out, "%" PRIu64, u);
+        }
+        else
+        {
+            memcpy(&d, rec, sizeof(d));
+            rec += sizeof(d);
+            fprintf(out, "%.4F", d);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/**
+ * @brief      Expand the payload of a keyframe or delta record into the same
+ *             layout as an uncompressed entry record without the type byte.
+ *
+ * @return     0 on success, -1 if the payload is malformed
+ */
+static int __decode_record(int type, const uint8_t* p, int len, char* rec)
+{
+    int i, n;
+    const uint8_t* end = p + len;
+    uint64_t v;
+    double d;
+
+    for (i = 0; i < header.num_fields; i++)
+    {
+        if (fields[i].type == LOG_TYPE_F64 && fields[i].resolution == 0.0)
+        {
+            if (end - p < (int)sizeof(double)) return -1;
+            memcpy(rec, p, sizeof(double));
+            p += sizeof(double);
+            rec += sizeof(double);
+            continue;
+        }
+
+        n = log_get_varint(p, end, &v);
+        if (n == -1) return -1;
+        p += n;
+        if (type == LOG_RECORD_KEYFRAME)
+            prev_value[i] = v;
+        else
+            prev_value[i] += (uint64_t)log_unzigzag(v);
+
+        if (fields[i].type == LOG_TYPE_U64)
+        {
+            memcpy(rec, &prev_value[i], sizeof(uint64_t));
+        }
+        else
+        {
+            d = log_dequantize((int64_t)prev_value[i], fields[i].resolution);
+            memcpy(rec, &d, sizeof(double));
+        }
+        rec += sizeof(uint64_t);
+    }
+    return (p == end) ? 0 : -1;
+}
+
+static void __print_timing(const uint8_t* p, int len)
+{
+    log_timing_stat_t s;
+
+    fprintf(stderr, "%-11s %9s %8s %8s %8s %8s %8s %8s  (us)\n", "stage", "count", "min", "p50",
+        "p99", "p99.9", "max", "overruns");
+    for (; len >= (int)sizeof(s); len -= sizeof(s), p += sizeof(s))
+    {
+        memcpy(&s, p, sizeof(s));
+        s.name[LOG_TIMING_NAME_LEN - 1] = 0;
+        fprintf(stderr, "%-11s %9u %8.1f %8.1f %8.1f %8.1f %8.1f %8u\n", s.name, s.count,
+            s.min_ns / 1e3, s.p50_ns / 1e3, s.p99_ns / 1e3, s.p999_ns / 1e3, s.max_ns / 1e3,
+            s.overruns);
+    }
+}
+
+static void __print_trailer(log_trailer_t* t)
+{
+    fprintf(stderr, "entries logged:     %" PRIu64 "\n", t->num_entries);
+    fprintf(stderr, "entries dropped:    %" PRIu64 "\n", t->num_dropped);
+    fprintf(stderr, "buffer high water:  %u of %u\n", t->high_water, t->buffer_len);
+    fprintf(stderr, "arming time:        %" PRIu64 " ns\n", t->arm_duration_ns);
+}
+
+int main(int argc, char* argv[])
+{
+    FILE* in;
+    FILE* out = stdout;
+    char rec[LOG_MAX_FIELDS * sizeof(double)];
+    uint8_t payload[LOG_MAX_FIELDS * LOG_VARINT_MAX_LEN];
+    uint16_t payload_len;
+    log_trailer_t trailer;
+    int type;
+    uint64_t num_entries = 0;
+    uint64_t num_skipped = 0;
+    int ret = 0;
+
+    if (argc < 2 || argc > 3)
+    {
+        print_usage();
+        return -1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "ERROR: can't open %s\n", argv[1]);
+        return -1;
+    }
+    if (__read_header(in) == -1)
+    {
+        fclose(in);
+        return -1;
+    }
+
+    if (argc == 3)
+    {
+        out = fopen(argv[2], "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "ERROR: can't open %s for writing\n", argv[2]);
+            fclose(in);
+            return -1;
+        }
+    }
+
+    __write_csv_header(out);
+
+    while ((type = fgetc(in)) != EOF)
+    {
+        if (type == LOG_RECORD_TRAILER)
+        {
+            if (fread(&trailer, sizeof(trailer), 1, in) != 1)
+            {
+                fprintf(stderr, "WARNING: truncated trailer\n");
+                break;
+            }
+            __print_trailer(&trailer);
+            continue;
+        }
+        if (type == LOG_RECORD_NONE)
+        {
+            fprintf(stderr, "WARNING: log not closed cleanly, stopping at preallocated space\n");
+            break;
+        }
+        if (type == LOG_RECORD_TIMING)
+        {
+            if (fread(&payload_len, sizeof(payload_len), 1, in) != 1 ||
+                payload_len > sizeof(payload) || fread(payload, payload_len, 1, in) != 1)
+            {
+                fprintf(stderr, "WARNING: truncated timing record\n");
+                break;
+            }
+            __print_timing(payload, payload_len);
+            continue;
+        }
+        if (type == LOG_RECORD_KEYFRAME || type == LOG_RECORD_DELTA)
+        {
+            if (fread(&payload_len, sizeof(payload_len), 1, in) != 1 ||
+                payload_len > sizeof(payload) || fread(payload, payload_len, 1, in) != 1)
+            {
+                fprintf(stderr, "WARNING: truncated final record, log was not closed cleanly\n");
+                break;
+            }
+            // deltas are meaningless until a keyframe has been seen
+            if (type == LOG_RECORD_KEYFRAME) have_keyframe = 1;
+            if (!have_keyframe)
+            {
+                num_skipped++;
+                continue;
+            }
+            if (__decode_record(type, payload, payload_len, rec) == -1)
+            {
+                fprintf(stderr, "ERROR: corrupt record after %" PRIu64 " entries\n", num_entries);
+                ret = -1;
+                break;
+            }
+            __write_csv_entry(out, rec);
+            num_entries++;
+            continue;
+        }
+        if (type != LOG_RECORD_ENTRY)
+        {
+            fprintf(stderr, "ERROR: unknown record type 0x%02x after %" PRIu64 " entries\n", type,
+                num_entries);
+            ret = -1;
+            break;
+        }
+        // a short final record means the vehicle lost power mid-write
+        if (fread(rec, header.record_len - 1, 1, in) != 1)
+        {
+            fprintf(stderr, "WARNING: truncated final record, log was not closed cleanly\n");
+            break;
+        }
+        __write_csv_entry(out, rec);
+        num_entries++;
+    }
+
+    if (num_skipped)
+    {
+        fprintf(stderr, "WARNING: skipped %" PRIu64 " records before the first keyframe\n",
+            num_skipped);
+    }
+
+    fclose(in);
+    if (out != stdout) fclose(out);
+    return ret;
+}
@@ -0,0 +1,315 @@
+/**
+ * @file rc_pilot_mix_bench.c
+ *
+ * Microbenchmark of motor mixing. For every rotor layout the same random
+ * control inputs are mixed with the generic per-channel mix_check_saturation
+ * and mix_add_input sequence feedback_march used to run and with the layout
+ * specialized mix_allocate kernel. The time per call of each is printed along
+ * with the number of motor outputs that differ in any bit, which must be 0.
+ *
+ * The thrust map lookup table is checked against the curve it was built from,
+ * it must stay within LUT_BUDGET of it, and a custom map is checked to be
+ * monotone after the PCHIP fit.
+ *
+ * The single precision mix_allocate_f32 and map_motor_signals_f32 used by the
+ * MIX_F32 build are timed too and cross-checked against the double precision
+ * versions. Build with MIX_F32=1 on the BeagleBone to measure the NEON code,
+ * elsewhere the plain C fallback is measured.
+ *
+ * Returns -1 if any check fails so it can be run after changing mix.c or
+ * thrust_map.c.
+ *
+ * Only depends on mix.c and thrust_map.c so it runs on the vehicle or a host
+ * computer.
+ *
+ * usage: rc_pilot_mix_bench [iterations]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mix.h>
+#include <rc_pilot_defs.h>
+#include <thrust_map.h>
+
+#define NUM_SAMPLES 1024  // distinct input vectors cycled through
+#define F32_TOL 1e-5      // largest difference allowed from the double versions
+#define LUT_POINTS 1000   // thrust_map_lut_len in the example settings
+#define LUT_BUDGET 1e-3   // largest thrust map lookup error allowed at LUT_POINTS
+
+static const char* layout_names[] = {
+    "4X", "4PLUS", "6X", "8X", "6DOF_ROTORBITS", "6DOF_5INCH_MONOCOQUE"};
+static const int layout_rotors[] = {4, 4, 6, 8, 6, 6};
+static const int layout_dof[] = {4, 4, 4, 4, 6, 6};
+static const char* map_names[] = {
+    "LINEAR_MAP", "MN1806_1400KV_4S", "F20_2300KV_2S", "RX2206_4S", "CUSTOM (RX2206 PCHIP)"};
+
+// the RX2206_4S measurements given as a custom map to check the PCHIP fit
+static const double custom_map[][2] = {{0.0, 0.0}, {0.05, 17.8844719758775},
+    {0.145, 44.8761484808831}, {0.24, 80.0271164157384}, {0.335, 122.556484678150},
+    {0.43, 168.358712108506}, {0.525, 220.433636910433}, {0.62, 277.201919870206},
+    {0.715, 339.008615108196}, {0.81, 418.819295994349}, {0.905, 505.430124336786},
+    {1.0, 566.758535098236}};
+
+static const double u_max[6] = {MAX_X_COMPONENT, MAX_Y_COMPONENT, 0.0, MAX_ROLL_COMPONENT,
+    MAX_PITCH_COMPONENT, MAX_YAW_COMPONENT};
+
+static double samples[NUM_SAMPLES][6];
+static float thrust_samples[NUM_SAMPLES][8];
+
+static uint64_t __nanos(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double __rand(double min, double max)
+{
+    return min + (max - min) * rand() / (double)RAND_MAX;
+}
+
+/**
+ * @brief      The sequence feedback_march ran in direct throttle mode before
+ *             mix_allocate
+ */
+static void __mix_sequential(const double u_in[6], int dof, double* mot)
+{
+    static const int order[] = {VEC_ROLL, VEC_PITCH, VEC_YAW, VEC_X, VEC_Y};
+    int i, ch;
+    double u, min, max;
+
+    for (i = 0; i < MAX_ROTORS; i++) mot[i] = 0.0;
+    mix_add_input(u_in[VEC_Z], VEC_Z, mot);
+    for (i = 0; i < dof - 1; i++)
+    {
+        ch = order[i];
+        mix_check_saturation(ch, mot, &min, &max);
+        if (max > u_max[ch]) max = u_max[ch];
+        if (min < -u_max[ch]) min = -u_max[ch];
+        u = u_in[ch];
+        if (min <= max)
+        {
+            if (u > max)
+                u = max;
+            else if (u < min)
+                u = min;
+        }
+        mix_add_input(u, ch, mot);
+    }
+}
+
+static double __abs(double x)
+{
+    return x < 0.0 ? -x : x;
+}
+
+/**
+ * @brief      Compare and time mix_allocate against the generic path and
+ *             mix_allocate_f32 against mix_allocate for every layout
+ *
+ * @return     0 if both agree, -1 otherwise
+ */
+static int __bench_mix(int n)
+{
+    int i, j, l, mismatch, ret = 0;
+    uint64_t t0, t_seq, t_alloc, t_f32;
+    double u[6], mot_seq[MAX_ROTORS], mot_alloc[MAX_ROTORS];
+    float mot_f32[MAX_ROTORS];
+    double err;
+    volatile double sink = 0.0;
+
+    printf("%-22s %10s %10s %10s %9s %9s\n", "layout", "seq ns", "alloc ns", "f32 ns",
+        "mismatch", "f32 err");
+    for (l = 0; l < (int)(sizeof(layout_rotors) / sizeof(layout_rotors[0])); l++)
+    {
+        if (mix_init((rotor_layout_t)l) < 0) return -1;
+
+        // generic and specialized must give the same motors for every sample,
+        // single precision within F32_TOL
+        mismatch = 0;
+        err = 0.0;
+        for (i = 0; i < NUM_SAMPLES; i++)
+        {
+            __mix_sequential(samples[i], layout_dof[l], mot_seq);
+            for (j = 0; j < 6; j++) u[j] = samples[i][j];
+            mix_allocate(u, u_max, NULL, mot_alloc);
+            for (j = 0; j < 6; j++) u[j] = samples[i][j];
+            mix_allocate_f32(u, u_max, NULL, mot_f32);
+            for (j = 0; j < layout_rotors[l]; j++)
+            {
+                if (memcmp(&mot_seq[j], &mot_alloc[j], sizeof(double)) != 0) mismatch++;
+                if (__abs(mot_f32[j] - mot_alloc[j]) > err) err = __abs(mot_f32[j] - mot_alloc[j]);
+            }
+        }
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            __mix_sequential(samples[i % NUM_SAMPLES], layout_dof[l], mot_seq);
+            sink += mot_seq[0];
+        }
+        t_seq = __nanos() - t0;
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < 6; j++) u[j] = samples[i % NUM_SAMPLES][j];
+            mix_allocate(u, u_max, NULL, mot_alloc);
+            sink += mot_alloc[0];
+        }
+        t_alloc = __nanos() - t0;
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < 6; j++) u[j] = samples[i % NUM_SAMPLES][j];
+            mix_allocate_f32(u, u_max, NULL, mot_f32);
+            sink += mot_f32[0];
+        }
+        t_f32 = __nanos() - t0;
+
+        printf("%-22s %10.1f %10.1f %10.1f %9d %9.2g\n", layout_names[l], (double)t_seq / n,
+            (double)t_alloc / n, (double)t_f32 / n, mismatch, err);
+        if (mismatch || err > F32_TOL) ret = -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief      Check the thrust map lookup table against the curve it was built
+ *             from and map_motor_signals_f32 against the table, then time all
+ *             three for 8 motors per call. The last map is a custom one so the
+ *             PCHIP fit is checked to be monotone too.
+ *
+ * @return     0 if everything is within budget, -1 otherwise
+ */
+static int __bench_thrust_map(int n)
+{
+    int i, j, k, ret = 0;
+    uint64_t t0, t_exact, t_lut, t_f32;
+    float in[8], out[8];
+    // out of range commands must be clamped like map_motor_signal, NaN to 0
+    static const float edge[8] = {NAN, -INFINITY, -0.5f, -0.0f, 0.0f, 1.0f, 1.5f, INFINITY};
+    double m, exact, lut, prev, lut_err, f32_err, mot[8], sig[8];
+    volatile double sink = 0.0;
+
+    printf("\n%-22s %10s %10s %10s %9s %9s %9s\n", "thrust map", "exact ns", "lut ns", "f32 ns",
+        "lut err", "lut bound", "f32 err");
+    for (k = 0; k < (int)(sizeof(map_names) / sizeof(map_names[0])); k++)
+    {
+        if (k == CUSTOM_MAP)
+        {
+            if (thrust_map_init_custom(custom_map, sizeof(custom_map) / sizeof(custom_map[0]),
+                    LUT_POINTS) < 0)
+                return -1;
+        }
+        else if (thrust_map_init((thrust_map_t)k, LUT_POINTS) < 0)
+            return -1;
+
+        // much finer than the table so the worst case between entries is seen
+        lut_err = 0.0;
+        f32_err = 0.0;
+        prev = 0.0;
+        for (i = 0; i <= 100000; i += 8)
+        {
+            for (j = 0; j < 8; j++) in[j] = (float)((i + j > 100000 ? 100000 : i + j) / 100000.0);
+            map_motor_signals_f32(in, out, 8);
+            for (j = 0; j < 8; j++)
+            {
+                m = (i + j > 100000 ? 100000 : i + j) / 100000.0;
+                exact = map_motor_signal_exact(m);
+                lut = map_motor_signal(m);
+                if (__abs(lut - exact) > lut_err) lut_err = __abs(lut - exact);
+                if (lut < prev)
+                {
+                    printf("%s not monotone at %f\n", map_names[k], m);
+                    ret = -1;
+                }
+                prev = lut;
+                if (__abs(out[j] - map_motor_signal(in[j])) > f32_err)
+                    f32_err = __abs(out[j] - map_motor_signal(in[j]));
+            }
+        }
+        map_motor_signals_f32(edge, out, 8);
+        for (j = 0; j < 8; j++)
+        {
+            if (!(__abs(out[j] - map_motor_signal(edge[j])) <= F32_TOL))
+            {
+                printf("%s f32 maps %f to %f, expected %f\n", map_names[k], edge[j], out[j],
+                    map_motor_signal(edge[j]));
+                ret = -1;
+            }
+        }
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < 8; j++)
+            {
+                sink += map_motor_signal_exact(thrust_samples[i % NUM_SAMPLES][j]);
+            }
+        }
+        t_exact = __nanos() - t0;
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            for (j = 0; j < 8; j++) mot[j] = thrust_samples[i % NUM_SAMPLES][j];
+            map_motor_signals(mot, sig, 8);
+            sink += sig[0];
+        }
+        t_lut = __nanos() - t0;
+
+        t0 = __nanos();
+        for (i = 0; i < n; i++)
+        {
+            map_motor_signals_f32(thrust_samples[i % NUM_SAMPLES], out, 8);
+            sink += out[0];
+        }
+        t_f32 = __nanos() - t0;
+
+        printf("%-22s %10.1f %10.1f %10.1f %9.2g %9.2g %9.2g\n", map_names[k], (double)t_exact / n,
+            (double)t_lut / n, (double)t_f32 / n, lut_err, thrust_map_lut_error(), f32_err);
+
+        // sampled error can't exceed what thrust_map_init worked out, it only
+        // checks a few points per interval of a smooth curve so allow a little
+        if (lut_err > thrust_map_lut_error() * 1.01 + 1e-12) ret = -1;
+        if (thrust_map_lut_error() > LUT_BUDGET) ret = -1;
+        if (f32_err > F32_TOL) ret = -1;
+    }
+    return ret;
+}
+
+int main(int argc, char* argv[])
+{
+    int i, j, n, ret = 0;
+
+    n = argc > 1 ? atoi(argv[1]) : 1000000;
+    if (n <= 0)
+    {
+        printf("usage: rc_pilot_mix_bench [iterations]\n");
+        return -1;
+    }
+
+    // hover-ish throttle with attitude inputs large enough to saturate often
+    srand(1);
+    for (i = 0; i < NUM_SAMPLES; i++)
+    {
+        samples[i][VEC_Z] = __rand(MIN_THRUST_COMPONENT, MAX_THRUST_COMPONENT);
+        samples[i][VEC_ROLL] = __rand(-0.5, 0.5);
+        samples[i][VEC_PITCH] = __rand(-0.5, 0.5);
+        samples[i][VEC_YAW] = __rand(-0.5, 0.5);
+        samples[i][VEC_X] = __rand(-0.5, 0.5);
+        samples[i][VEC_Y] = __rand(-0.5, 0.5);
+        for (j = 0; j < 8; j++) thrust_samples[i][j] = (float)__rand(0.0, 1.0);
+    }
+
+    if (__bench_mix(n) < 0) ret = -1;
+    if (__bench_thrust_map(n) < 0) ret = -1;
+    return ret;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file rc_pilot_seqlock_stress.c
+ *
+ * Stress test of the seqlock used to publish snapshots to other threads. One
+ * writer thread publishes a block the size of a flight state snapshot as fast
+ * as it can, every word set to the publish count, while reader threads copy it
+ * out with seqlock_read. Every copy a reader accepts must have all words equal
+ * and never go backwards, anything else is counted as torn and must be 0.
+ * Reads thrown away because the writer got in the way are counted too, they
+ * only show how much contention there was.
+ *
+ * Returns -1 if any torn copy got through so it can be run after changing
+ * seqlock.h. Run it on the BeagleBone as well as a multicore host, the single
+ * core case is the one where a reader gets preempted mid-copy.
+ *
+ * usage: rc_pilot_seqlock_stress [seconds] [readers]
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <seqlock.h>
+
+#define PAYLOAD_WORDS 256  // 2kB, a bit more than a snapshot_t
+#define MAX_READERS 16
+#define READ_TRIES 1       // every failed attempt is counted as contention
+
+typedef struct payload_t
+{
+    uint64_t word[PAYLOAD_WORDS];
+} payload_t;
+
+typedef struct reader_stats_t
+{
+    uint64_t reads;   // copies accepted
+    uint64_t failed;  // copies thrown away
+    uint64_t torn;    // accepted copies that were inconsistent
+} reader_stats_t;
+
+static payload_t shared;
+static seqlock_t lock = SEQLOCK_INITIALIZER;
+static atomic_int running;
+static uint64_t published;
+
+static void* __writer_func(__attribute__((unused)) void* ptr)
+{
+    int i;
+    payload_t p;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        published++;
+        for (i = 0; i < PAYLOAD_WORDS; i++) p.word[i] = published;
+        seqlock_write(&lock, &shared, &p, sizeof(p));
+    }
+    return NULL;
+}
+
+static void* __reader_func(void* ptr)
+{
+    int i;
+    uint64_t last = 0;
+    payload_t p;
+    reader_stats_t* s = ptr;
+
+    while (atomic_load_explicit(&running, memory_order_relaxed))
+    {
+        if (seqlock_read(&lock, &p, &shared, sizeof(p), READ_TRIES))
+        {
+            s->failed++;
+            continue;
+        }
+        s->reads++;
+        for (i = 1; i < PAYLOAD_WORDS; i++)
+        {
+            if (p.word[i] != p.word[0]) break;
+        }
+        if (i < PAYLOAD_WORDS || p.word[0] < last)
+            s->torn++;
+        else
+            last = p.word[0];
+    }
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    int i, seconds, n;
+    pthread_t writer, readers[MAX_READERS];
+    reader_stats_t stats[MAX_READERS] = {{0}};
+    reader_stats_t total = {0};
+    struct timespec ts;
+
+    seconds = argc > 1 ? atoi(argv[1]) : 5;
+    n = argc > 2 ? atoi(argv[2]) : 3;
+    if (seconds <= 0 || n <= 0 || n > MAX_READERS)
+    {
+        printf("usage: rc_pilot_seqlock_stress [seconds] [readers 1-%d]\n", MAX_READERS);
+        return -1;
+    }
+
+    atomic_store(&running, 1);
+    if (pthread_create(&writer, NULL, __writer_func, NULL))
+    {
+        fprintf(stderr, "ERROR: failed to start writer thread\n");
+        return -1;
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (pthread_create(&readers[i], NULL, __reader_func, &stats[i]))
+        {
+            fprintf(stderr, "ERROR: failed to start reader thread\n");
+            atomic_store(&running, 0);
+            n = i;
+            break;
+        }
+    }
+
+    ts.tv_sec = seconds;
+    ts.tv_nsec = 0;
+    nanosleep(&ts, NULL);
+    atomic_store(&running, 0);
+    pthread_join(writer, NULL);
+    for (i = 0; i < n; i++) pthread_join(readers[i], NULL);
+
+    printf("%-8s %14s %14s %10s\n", "reader", "reads", "failed", "torn");
+    for (i = 0; i < n; i++)
+    {
+        printf("%-8d %14llu %14llu %10llu\n", i, (unsigned long long)stats[i].reads,
+            (unsigned long long)stats[i].failed, (unsigned long long)stats[i].torn);
+        total.reads += stats[i].reads;
+        total.failed += stats[i].failed;
+        total.torn += stats[i].torn;
+    }
+    printf("%-8s %14llu %14llu %10llu\n", "total", (unsigned long long)total.reads,
+        (unsigned long long)total.failed, (unsigned long long)total.torn);
+    printf("%llu snapshots published\n", (unsigned long long)published);
+
+    if (total.torn || total.reads == 0)
+    {
+        printf("FAILED\n");
+        return -1;
+    }
+    printf("PASSED\n");
+    return 0;
+}